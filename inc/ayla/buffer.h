@@ -33,11 +33,56 @@ enum queue_buf_opts {
 };
 
 /*
- * Queue buffer linked list element.
+ * Reference counted segment storage.  Segments may be referenced by
+ * elements of several queues and are only written in place while they
+ * have a single reference.
+ */
+struct queue_buf_seg {
+	struct queue_buf_seg *next;	/* on the pool free list */
+	struct queue_buf_pool *pool;	/* NULL if malloc'd */
+	unsigned refcnt;
+	size_t size;
+	u8 buf[0];
+};
+
+/*
+ * Queue buffer linked list element, a window onto a segment.
  */
 struct queue_buf_data {
 	struct queue_buf_data *next;
-	struct buf_data data;
+	struct queue_buf_seg *seg;
+	struct {
+		size_t size;	/* space from buf to the end of the segment */
+		size_t len;
+		u8 *buf;
+	} data;
+};
+
+/*
+ * Fixed size segment pool.  Segments up to seg_size are taken from and
+ * returned to the pool, keeping up to max_free spare segments and list
+ * elements for reuse.  Not thread safe.  The pool must outlive every
+ * queue and detached element using it.
+ */
+struct queue_buf_pool {
+	size_t seg_size;
+	unsigned max_free;
+	unsigned nfree;
+	unsigned nfree_dp;
+	unsigned in_use;
+	unsigned high;
+	struct queue_buf_seg *free_seg;
+	struct queue_buf_data *free_dp;
+};
+
+/*
+ * Per queue segment statistics.
+ */
+struct queue_buf_stats {
+	unsigned long allocs;	/* segments allocated for this queue */
+	unsigned long pool_hits;	/* allocations served by the pool free list */
+	unsigned long shared;	/* segment references taken from other queues */
+	unsigned long released;	/* segment references dropped */
 };
 
 /*
@@ -50,8 +95,21 @@ struct queue_buf {
 	unsigned opt_mask;
 	struct queue_buf_data *first;
 	struct queue_buf_data *last;
+	struct queue_buf_pool *pool;
+	struct queue_buf_stats stats;
 };
 
+/*
+ * Initialize a segment pool for segments of seg_size bytes.
+ */
+void queue_buf_pool_init(struct queue_buf_pool *pool, size_t seg_size,
+	unsigned max_free);
+
+/*
+ * Frees the spare segments and elements held by the pool.
+ */
+void queue_buf_pool_destroy(struct queue_buf_pool *pool);
+
 /*
  * Initialize a queue_buf.
  *   opts: bit mask of queue_buf_opts
@@ -62,6 +120,17 @@ struct queue_buf {
  */
 int queue_buf_init(struct queue_buf *qbuf, unsigned opts, size_t min_buf_size);
 
+/*
+ * Allocate new segments for the queue from pool, NULL for malloc.  Call
+ * after queue_buf_init() and before any data is put.
+ */
+void queue_buf_set_pool(struct queue_buf *qbuf, struct queue_buf_pool *pool);
+
+/*
+ * Return the segment statistics of the queue.
+ */
+const struct queue_buf_stats *queue_buf_stats(const struct queue_buf *qbuf);
+
 /*
  * Frees all allocated buffers and resets queue state.
  */
@@ -101,6 +170,15 @@ void queue_buf_trim_head(struct queue_buf *qbuf, size_t new_len);
  */
 int queue_buf_concat(struct queue_buf *qbuf1, struct queue_buf *qbuf2);
 
+/*
+ * Appends len bytes of src, starting at offset, to the end of dst by
+ * reference.  The segments are shared, not copied, and stay writable by
+ * neither queue until one side drops them.
+ * Returns 0 on success or -1 on failure.
+ */
+int queue_buf_share(struct queue_buf *dst, const struct queue_buf *src,
+	size_t offset, size_t len);
+
 /*
  * Combines data from all linked buffer elements into the first element,
  * then returns a pointer to the first element's buffer.  This is useful if
@@ -136,6 +214,56 @@ int queue_buf_putf(struct queue_buf *qbuf, const char *fmt, ...)
  */
 int queue_buf_put_head(struct queue_buf *qbuf, const void *data, size_t len);
 
+/*
+ * Maximum number of iovecs used by a single queue_buf_readv() or
+ * queue_buf_writev() call.
+ */
+#define QBUF_IOV_MAX	16
+
+struct iovec;
+
+/*
+ * Reads up to len bytes from fd directly into the buffer with one readv(),
+ * filling any empty space in the last buffer first, then new buffers of at
+ * least min_buf_size.  With a pool set, new buffers are split into pool
+ * segments.  New buffers are only linked if data was read into them.
+ * Returns the number of bytes read, 0 on end of file, or -1 on failure
+ * (errno is set).
+ */
+ssize_t queue_buf_readv(int fd, struct queue_buf *qbuf, size_t len);
+
+/*
+ * Same as queue_buf_readv().
+ */
+ssize_t queue_buf_recv(struct queue_buf *qbuf, int fd, size_t len);
+
+/*
+ * Fills up to max iovecs with the buffer data starting at offset, without
+ * copying.  The iovecs are valid until the queue is next modified.
+ * Returns the number of iovecs filled.
+ */
+int queue_buf_to_iovec(const struct queue_buf *qbuf, struct iovec *iov,
+	int max, size_t offset);
+
+/*
+ * Writes the buffer data to fd with one writev() of up to QBUF_IOV_MAX
+ * segments and removes whatever was written from the front of the queue.
+ * Returns the number of bytes written, or -1 on failure (errno is set).
+ */
+ssize_t queue_buf_writev(int fd, struct queue_buf *qbuf);
+
+/*
+ * Unlinks the first buffer element and transfers its ownership to the caller,
+ * who must queue_buf_data_free() it when done.  Returns NULL if the queue is
+ * empty.
+ */
+struct queue_buf_data *queue_buf_detach_head(struct queue_buf *qbuf);
+
+/*
+ * Frees a detached buffer element, dropping its segment reference.
+ */
+void queue_buf_data_free(struct queue_buf_data *dp);
+
 /*
  * Copies up to len bytes of data into buf, starting at the specified offset.
  * Returns the number of bytes copied (may be less than len, if the end of
@@ -152,6 +280,58 @@ size_t queue_buf_copyout(const struct queue_buf *qbuf, void *buf, size_t len,
 int queue_buf_walk(const struct queue_buf *qbuf,
 	int (*callback)(const void *, size_t, void *), void *arg);
 
+/*
+ * Returns a pointer to len bytes at offset if they sit in a single segment,
+ * otherwise NULL.  The pointer is valid until the queue is next modified.
+ */
+const void *queue_buf_peek(const struct queue_buf *qbuf, size_t offset,
+	size_t len);
+
+/*
+ * Read-only view of a byte range of a queue_buf.  The view shares and pins
+ * the segments it covers, so it stays valid after the source queue is
+ * trimmed, reset or destroyed.  ptr is set if the range sits in a single
+ * segment.
+ */
+struct queue_buf_view {
+	struct queue_buf pin;
+	const u8 *ptr;
+	size_t len;
+};
+
+/*
+ * Sets up a view of len bytes of qbuf starting at offset.
+ * Returns 0 on success or -1 on failure.
+ */
+int queue_buf_view_init(struct queue_buf_view *view,
+	const struct queue_buf *qbuf, size_t offset, size_t len);
+
+/*
+ * Sets up slice as a view of len bytes of view starting at offset.
+ * Returns 0 on success or -1 on failure.
+ */
+int queue_buf_view_slice(struct queue_buf_view *slice,
+	const struct queue_buf_view *view, size_t offset, size_t len);
+
+/*
+ * Drops the view's segment references.
+ */
+void queue_buf_view_release(struct queue_buf_view *view);
+
+/*
+ * Copies up to len bytes of the view into buf, starting at the specified
+ * offset.  Returns the number of bytes copied.
+ */
+size_t queue_buf_view_copyout(const struct queue_buf_view *view, void *buf,
+	size_t len, size_t offset);
+
+/*
+ * Invokes callback for each contiguous piece of the view, as
+ * queue_buf_walk().
+ */
+int queue_buf_view_walk(const struct queue_buf_view *view,
+	int (*callback)(const void *, size_t, void *), void *arg);
+
 #ifdef SUPPORT_JSON
 /*
  * Appends data in JSON format to the end of the buffer.  Puts behave the same
@@ -166,6 +346,12 @@ int queue_buf_put_json(struct queue_buf *qbuf, const json_t *json);
  * Buffer data does not need to be NULL terminated.
  */
 json_t *queue_buf_parse_json(const struct queue_buf *qbuf, size_t offset);
+
+/*
+ * Parses the JSON encoded data of a view, in place if it is contiguous.
+ * Returns a pointer to the JSON structure, or NULL, if parsing failed.
+ */
+json_t *queue_buf_view_parse_json(const struct queue_buf_view *view);
 #endif
 
 /*
@@ -41,6 +41,25 @@ int crypto_init_rsa(struct crypto_state *state,
 int crypto_init_aes(struct crypto_state *state,
 	const u8 *iv, const u8 *key, size_t key_len);
 
+/*
+ * AES GCM message layout: nonce, ciphertext, tag.
+ */
+#define CRYPTO_GCM_NONCE_LEN	12
+#define CRYPTO_GCM_TAG_LEN	16
+#define CRYPTO_GCM_OVERHEAD	(CRYPTO_GCM_NONCE_LEN + CRYPTO_GCM_TAG_LEN)
+
+/*
+ * Initialize the crypto_state for AES GCM authenticated encryption with
+ * a 16, 24 or 32 byte key.  Each encrypt call seals one message under
+ * the next nonce, which is sent in front of the ciphertext, so the output
+ * is CRYPTO_GCM_OVERHEAD bytes larger than the input.  Nonces start at a
+ * random value and count up.  Decrypt verifies the tag and only accepts
+ * messages in the order they were encrypted, replays are rejected.
+ * In-place operation is not supported.
+ */
+int crypto_init_aes_gcm(struct crypto_state *state,
+	const u8 *key, size_t key_len);
+
 /*
  * Encrypt the data in in_buf and write it to out_buf.
  * Returns the number of bytes written to out_buf, or -1 on error.
@@ -66,4 +85,20 @@ ssize_t crypto_decrypt(struct crypto_state *state,
  */
 void crypto_cleanup(struct crypto_state *state);
 
+/*
+ * Fill buf with len bytes from the random number generator.
+ * Returns 0 on success, or -1 on error.
+ */
+int crypto_random(void *buf, size_t len);
+
+/*
+ * HKDF with SHA-256 (RFC 5869): derive out_len bytes of key material from
+ * the input key, the salt and the context info.
+ * Returns 0 on success, or -1 on error.
+ */
+int crypto_hkdf_sha256(void *out, size_t out_len,
+	const void *key, size_t key_len,
+	const void *salt, size_t salt_len,
+	const void *info, size_t info_len);
+
 #endif /* __AYLA_CRYPTO_RSA_H__ */
@@ -0,0 +1,41 @@
+#ifndef _CHANQ_H_
+#define _CHANQ_H_
+
+#include "list.h"
+#include "event.h"
+#include "frame.h"
+
+/*
+ * One level per event priority, each a set of per channel queues served
+ * by deficit round robin on e->len.  Levels are served most urgent first:
+ * a level with weight 0 is strict and always wins, otherwise a level may
+ * pop weight events per round, so bulk traffic is slowed, not starved.
+ */
+#define CHANQ_WEIGHTS	{ 0, 4, 1 }	/* EVENT_PRIO_HIGH, NORMAL, BULK */
+
+typedef struct stChanLevel {
+	stIList_t q[CHAN_MAX];	/* of stEvent_t.node */
+	int deficit[CHAN_MAX];
+	int cur;
+	int credited;
+	int size;
+	int weight;
+	int credit;
+}stChanLevel_t;
+
+typedef struct stChanQueue {
+	stChanLevel_t lv[EVENT_PRIO_MAX];
+	int depth[CHAN_MAX];
+	int quantum;
+	int size;
+}stChanQueue_t;
+
+void chanq_init(stChanQueue_t *cq, int quantum);
+void chanq_push(stChanQueue_t *cq, stEvent_t *e);
+bool chanq_pop(stChanQueue_t *cq, stEvent_t **e);
+int  chanq_size(stChanQueue_t *cq);
+int  chanq_depth(stChanQueue_t *cq, int chan);
+int  chanq_level_size(stChanQueue_t *cq, int prio);
+void chanq_weight(stChanQueue_t *cq, int prio, int weight);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include "utypes.h"
+
+/*
+ * Stream codecs for the link.  The encoder of a connection takes whole
+ * frames and keeps its output until flush closes the batch on a boundary
+ * the peer can decode (deflate: sync flush), so everything sent between
+ * two POLLOUT flushes compresses together.  The decoder turns wire bytes
+ * back into the frame stream.  A codec is one stCodecOps_t in codec.c.
+ *
+ * Codecs are agreed with FRAME_HELLO, NUL terminated json payloads:
+ *   offer:  { "offer": [ "deflate" ], "dict": <id> }
+ *   answer: { "codec": "deflate", "dict": <id or 0> }
+ * The client offers, the server answers and encodes everything it sends
+ * after the answer, the client sends the same answer back and encodes
+ * everything after it.  "dict" selects the preset dictionary when both
+ * ends loaded the same one.
+ */
+#define CODEC_HELLO_MAX		128
+#define CODEC_DECODE_MAX	(1024 * 1024)	/* decoded bytes one read may add */
+
+struct queue_buf;
+typedef struct stCodec stCodec_t;
+
+typedef struct stCodecOps {
+	const char *name;
+	int (*init)(stCodec_t *c, const void *dict, unsigned int dlen);
+	int (*encode)(stCodec_t *c, const void *in, unsigned int len);
+	int (*flush)(stCodec_t *c);
+	int (*decode)(stCodec_t *c, const void *in, unsigned int len, struct queue_buf *qb);
+	void (*free)(stCodec_t *c);
+}stCodecOps_t;
+
+struct stCodec {
+	const stCodecOps_t *ops;
+	int enc;
+	void *priv;
+	char *obuf;		/* encoder output of the open batch */
+	unsigned int olen;
+	unsigned int osize;
+	unsigned int pending;	/* input bytes since the last flush */
+	unsigned int room;	/* decoder: bytes the current read may still add */
+	u64 raw;		/* frame bytes in or out */
+	u64 wire;		/* their size on the link */
+};
+
+/* enc: 1 -> encode what we send, 0 -> decode what we receive */
+stCodec_t *codec_new(const char *name, int enc, const void *dict, unsigned int dlen);
+void codec_free(stCodec_t *c);
+int codec_encode(stCodec_t *c, const void *in, unsigned int len);
+/* close the batch, *out is malloc'ed and NULL if there was nothing */
+int codec_flush(stCodec_t *c, char **out, unsigned int *olen);
+int codec_decode(stCodec_t *c, const void *in, unsigned int len, struct queue_buf *qb);
+/* run what qb already holds through the decoder, for a mid-read switch */
+int codec_decode_qb(stCodec_t *c, struct queue_buf *qb);
+/* tcp_readv through the record layer and the decoder, both may be NULL */
+struct stSeal;
+int codec_recv(stCodec_t *c, struct stSeal *s, int fd, struct queue_buf *qb, unsigned int _size);
+/* room the encoder output must have, for stCodecOps_t implementations */
+int codec_reserve(stCodec_t *c, unsigned int len);
+
+/* preset dictionary, PKT samples, the last 32K are used */
+int codec_dict_load(const char *path);
+const void *codec_dict(unsigned int *len);
+u32 codec_dict_id(void);
+
+int codec_hello_offer(char *buf, int size, const char *name);
+int codec_hello_answer(char *buf, int size, const char *name, int dict);
+/* name (NULL -> none) agreed with want, *dict -> use the dictionary */
+const char *codec_hello_parse(const char *spec, const char *want, int *offer, int *dict);
+
+#endif
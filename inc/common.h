@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <utypes.h>
 
+#include "mem.h"
+
 #define MAJOR    0
 #define MINOR    0
 #define PATCH    0
@@ -12,8 +14,9 @@
 #define VERSION() (RELEASE | (PATCH << 8) | (MINOR << 16) | (MAJOR << 24))
 #define VERSION_STR() ("V"##MAJOR##"."##MINOR##"."##PATCH##"."##RELEASE)
 
-#define MALLOC(size) malloc(size)
-#define FREE(p) free(p)
+/* see mem.h, the call site is recorded by the debug allocator */
+#define MALLOC(size) mem_alloc(size, __FILE__, __LINE__)
+#define FREE(p) mem_free(p)
 
 //#ifndef bool
 //#define bool unsigned int
@@ -0,0 +1,42 @@
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include "utypes.h"
+#include "timer.h"
+#include "hashmap.h"
+
+#define DEDUP_MAX		4096	/* remembered payloads, the oldest goes first */
+
+/*
+ * Drops exact repeats of a (chan, topic, PKT) seen within window ms, such
+ * as zigbee retransmissions published several times by the gateway.  The
+ * window is fixed, so insertion order is also expiry order: entries sit in
+ * a FIFO and one timer reaps its head.
+ */
+typedef struct stDedupEntry {
+	struct stDedupEntry *next;
+	size_t hash;
+	u64 expire;
+	int chan;
+	int len;
+	char data[0];	/* topic\0pkt\0 */
+}stDedupEntry_t;
+
+typedef struct stDedup {
+	struct hashmap map;
+	struct timer timer;
+	struct timer_head *th;
+	stDedupEntry_t *head;
+	stDedupEntry_t *tail;
+	int window;		/* ms, 0 -> disabled */
+	int count;
+	unsigned int hits;
+	unsigned int misses;
+}stDedup_t;
+
+int dedup_init(stDedup_t *d, struct timer_head *th, int window);
+void dedup_free(stDedup_t *d);
+/* 1 -> repeat within the window, drop it; 0 -> first copy, remembered */
+int dedup_check(stDedup_t *d, int chan, const char *topic, const char *pkt);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _EVENT_H_
+#define _EVENT_H_
+
+#include "utypes.h"
+#include "list.h"
+
+/* scheduling class of an event, lower is more urgent */
+enum {
+	EVENT_PRIO_HIGH = 0,
+	EVENT_PRIO_NORMAL,
+	EVENT_PRIO_BULK,
+	EVENT_PRIO_MAX,
+};
+#define EVENT_PRIO_NAMES	{ "high", "normal", "bulk" }
+
+/* Event */
+typedef struct stEvent {
+	stListNode_t node;	/* queue links, an event waits in one queue at a time */
+	int type;
+	int chan;
+	int prio;
+	int len;
+	void *data;
+	int ref;
+	void (*release)(void *);	/* frees owner, data points into it */
+	void *owner;
+	u64 ts;	/* creation time in us, for latency stats */
+}stEvent_t;
+
+/* room kept in front of data for the link frame header */
+#define EVENT_HEADROOM	8
+
+stEvent_t *event_packet(int _type, int _len, void *data);
+stEvent_t *event_wrap(int _type, int _len, void *data,
+											void (*release)(void *), void *owner);
+stEvent_t *event_get(stEvent_t *e);
+void event_put(stEvent_t *e);
+void event_release(void *arg);
+u64 event_now_us(void);
+
+#endif
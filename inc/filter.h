@@ -0,0 +1,61 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include "utypes.h"
+#include "event.h"
+
+#include <jansson.h>
+
+/*
+ * Subscription filter of one connection, compiled from a FRAME_SUB:
+ *   { "topics": [ "DS.GATEWAY", "DS.ZB." ],
+ *     "where":  [ { "field": "cmd", "op": "eq", "value": "report" } ] }
+ * An event passes if its topic starts with any of the prefixes (no
+ * prefixes -> any topic) and PKT, parsed as a json object, satisfies all
+ * predicates.  A connection without a filter receives everything.
+ */
+enum {
+	FILTER_EQ = 0,
+	FILTER_NE,
+	FILTER_PREFIX,
+	FILTER_EXISTS,
+};
+
+typedef struct stFilterPred {
+	char *field;
+	char *value;
+	int vlen;
+	int op;
+}stFilterPred_t;
+
+typedef struct stFilter {
+	int active;
+	char **prefix;
+	int *plen;
+	int nprefix;
+	stFilterPred_t *pred;
+	int npred;
+	unsigned int passed;
+	unsigned int dropped;
+}stFilter_t;
+
+/* per event state shared by all filters, PKT is parsed at most once */
+typedef struct stFilterCtx {
+	stEvent_t *e;
+	const char *topic;
+	const char *pkt;
+	json_t *root;
+	int parsed;
+}stFilterCtx_t;
+
+void filter_init(stFilter_t *f);
+void filter_free(stFilter_t *f);
+int  filter_compile(stFilter_t *f, const char *spec);
+
+/* dir: ROUTE_SUB for ubus events, ROUTE_PUB for frames from the link, the
+ * route a DATA frame's topic is taken from */
+void filter_ctx_init(stFilterCtx_t *ctx, stEvent_t *e, int dir);
+void filter_ctx_free(stFilterCtx_t *ctx);
+bool filter_match(stFilter_t *f, stFilterCtx_t *ctx);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include "utypes.h"
+#include "event.h"
+
+/*
+ * Link framing: every message on the TCP link is an 8 byte header
+ * followed by len bytes of payload.  chan selects the route the payload
+ * belongs to, DATA payloads are NUL terminated PKT strings.  TOPIC frames
+ * serve wildcard routes and carry "topic\0PKT\0".  SUB frames carry a NUL
+ * terminated json subscription, see filter.h.
+ *
+ * REQ frames call a ubus method on the far side, RESP frames answer them
+ * in completion order, matched by id:
+ *   REQ:  be32 id, "path\0method\0json args\0"
+ *   RESP: be32 id, be32 ubus status, "json reply\0"
+ *
+ * HELLO frames agree on a stream codec at connect time, see codec.h.
+ */
+#define FRAME_MAGIC		0xA5
+#define FRAME_HDR_LEN	8
+#define FRAME_MAX			(64 * 1024)
+
+enum {
+	FRAME_DATA = 0,
+	FRAME_PING,
+	FRAME_PONG,
+	FRAME_TOPIC,
+	FRAME_SUB,
+	FRAME_REQ,
+	FRAME_RESP,
+	FRAME_HELLO,
+};
+
+typedef struct stFrameHdr {
+	u8 magic;
+	u8 type;
+	be16 chan;
+	be32 len;
+} PACKED stFrameHdr_t;
+
+typedef struct stFrameRpc {
+	be32 id;
+	be32 status;	/* RESP only */
+} PACKED stFrameRpc_t;
+
+/* channels, 0 is reserved for link control */
+#define CHAN_CTRL		0
+#define CHAN_MAX		32
+
+void frame_header(void *buf, int type, int chan, u32 len);
+/* fill in the header in front of e->data, returns the start of the frame */
+void *frame_encode(stEvent_t *e, int type);
+/* queue a copy of data as one frame */
+struct stTcpOut;
+int frame_send(struct stTcpOut *out, int type, int chan, const void *data, u32 len);
+/* queue a payload-less control frame (ping/pong) on CHAN_CTRL */
+int frame_send_ctrl(struct stTcpOut *out, int type);
+/* split complete frames off qb into events, -1 on a protocol error.  A push
+ * returning > 0 stops the split, the rest stays in qb (stream switch) */
+struct queue_buf;
+int frame_recv(struct queue_buf *qb,
+							 int (*push)(stEvent_t *e, void *arg), void *arg);
+
+#endif
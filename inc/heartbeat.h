@@ -0,0 +1,39 @@
+#ifndef _HEARTBEAT_H_
+#define _HEARTBEAT_H_
+
+#include "utypes.h"
+#include "timer.h"
+
+#define HEARTBEAT_INTERVAL	2000	/* ms */
+#define HEARTBEAT_LIMIT			3			/* missed beats before the peer is dead */
+
+/*
+ * One timer per connection.  Every interval without inbound traffic counts
+ * as a missed beat and sends a ping, limit missed beats in a row declare
+ * the peer dead.  Inbound traffic only sets a flag, so the hot path never
+ * touches the timer list.
+ */
+typedef struct stHeartbeat {
+	struct timer timer;
+	struct timer_head *th;
+	int interval;
+	int limit;
+	int missed;
+	int rx;
+	void (*ping)(struct stHeartbeat *hb);
+	void (*dead)(struct stHeartbeat *hb);
+	void *arg;
+}stHeartbeat_t;
+
+void heartbeat_init(stHeartbeat_t *hb, struct timer_head *th,
+										int interval, int limit,
+										void (*ping)(stHeartbeat_t *), void (*dead)(stHeartbeat_t *),
+										void *arg);
+void heartbeat_start(stHeartbeat_t *hb);
+void heartbeat_stop(stHeartbeat_t *hb);
+
+static inline void heartbeat_feed(stHeartbeat_t *hb) {
+	hb->rx = 1;
+}
+
+#endif
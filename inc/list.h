@@ -9,10 +9,15 @@ typedef struct _stListItem {
   void *data;
 }stListItem_t;
 
+/* popped items are kept for the next push, up to this many per list */
+#define LIST_CACHE_MAX	32
+
 typedef struct _stList {
   stListItem_t *head;
   stListItem_t *tail;
   int size;
+  stListItem_t *cache;
+  int ncache;
 }stList_t;
 
 void list_init(stList_t *l);
@@ -24,6 +29,41 @@ bool list_peek_front(stList_t *l, void **data);
 bool list_peek_back(stList_t *l, void **data);
 void list_destroy(stList_t *l, void (*freefunc)(void*));
 int  list_size(stList_t *l);
+bool list_empty(stList_t *l);
 bool list_null();
 
+/*
+ * Intrusive variant: the links live in the element, which can then sit in
+ * one list at a time and costs no allocation to queue.
+ */
+typedef struct _stListNode {
+  struct _stListNode *prev;
+  struct _stListNode *next;
+}stListNode_t;
+
+typedef struct _stIList {
+  stListNode_t *head;
+  stListNode_t *tail;
+  int size;
+}stIList_t;
+
+#define ilist_entry(node, type, member) CONTAINER_OF(type, member, node)
+
+void ilist_init(stIList_t *l);
+void ilist_push_front(stIList_t *l, stListNode_t *n);
+void ilist_push_back(stIList_t *l, stListNode_t *n);
+stListNode_t *ilist_pop_front(stIList_t *l);
+stListNode_t *ilist_pop_back(stIList_t *l);
+void ilist_remove(stIList_t *l, stListNode_t *n);
+
+static inline stListNode_t *ilist_peek_front(stIList_t *l) {
+  return l->head;
+}
+static inline int ilist_size(stIList_t *l) {
+  return l->size;
+}
+static inline bool ilist_empty(stIList_t *l) {
+  return l->size == 0;
+}
+
 #endif
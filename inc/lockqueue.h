@@ -5,16 +5,53 @@
 #include "cond.h"
 #include "list.h"
 
+/*
+ * make LOCKQUEUE=ring builds the queue as a bounded lock-free ring for
+ * many producers and one consumer: pop, peek, pop_back and the batch pop
+ * belong to a single thread.  push never fails, what does not fit the
+ * ring spills into the locked list and producers keep following it there
+ * until the consumer drained it, so each producer's order is kept.
+ * try_push reports a full ring instead of spilling.  make test runs
+ * test/bench_lockqueue.c against both builds.
+ */
+#define LOCKQUEUE_RING_SIZE	1024	/* power of two */
+#define LOCKQUEUE_CACHELINE	64
+
+#ifdef LOCKQUEUE_RING
+typedef struct _stLockQueueSlot {
+  unsigned long seq;
+  void *elem;
+}stLockQueueSlot_t;
+
+typedef struct _stLockCondQueue {
+  unsigned long tail;		/* producers */
+  char pad0[LOCKQUEUE_CACHELINE];
+  unsigned long head;		/* consumer */
+  char pad1[LOCKQUEUE_CACHELINE];
+  stLockQueueSlot_t *ring;
+  unsigned long mask;
+  int spilled;
+  stMutex_t mtx;
+  stCond_t cond;
+  stList_t list;
+}stLockQueue_t;
+#else
 typedef struct _stLockCondQueue {
   stMutex_t mtx;
   stCond_t cond;
   stList_t list;
 }stLockQueue_t;
+#endif
 
 void lockqueue_init(stLockQueue_t *lq);
 void lockqueue_push(stLockQueue_t *lq, void *elem);
+/* false -> full, elem was not queued */
+bool lockqueue_try_push(stLockQueue_t *lq, void *elem);
 bool lockqueue_pop(stLockQueue_t *lq, void **elem);
+/* pops up to max elements in order, returns how many */
+int  lockqueue_pop_batch(stLockQueue_t *lq, void **elems, int max);
 bool lockqueue_pop_back(stLockQueue_t *lq, void **elem);
+bool lockqueue_peek(stLockQueue_t *lq, void **elem);
 void lockqueue_destroy(stLockQueue_t *lq, void (*free_elem)(void*));
 void lockqueue_wake(stLockQueue_t *lq);
 void lockqueue_wait(stLockQueue_t *lq);
@@ -0,0 +1,43 @@
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stddef.h>
+#include <utypes.h>
+
+/*
+ * Allocator behind MALLOC/FREE.  "system" is plain malloc, "pool" the
+ * size class pool and "debug" malloc with per call site accounting.
+ * The default is MEM_DEFAULT (make ALLOC=...), overridden at run time by
+ * the BRIDGE_ALLOC environment variable or mem_select() before the first
+ * allocation; blocks can only go back to the allocator they came from.
+ */
+#ifndef MEM_DEFAULT
+#define MEM_DEFAULT		"system"
+#endif
+#define MEM_SITE_MAX	128
+
+typedef struct stMemStats {
+	const char *name;
+	u64 allocs;
+	u64 frees;
+	size_t bytes;			/* debug only */
+	size_t peak;
+}stMemStats_t;
+
+typedef struct stMemSite {
+	const char *file;
+	int line;
+	u32 allocs;
+	u32 live;
+	size_t bytes;
+	size_t peak;
+}stMemSite_t;
+
+int mem_select(const char *name);
+void *mem_alloc(size_t size, const char *file, int line);
+void mem_free(void *p);
+void mem_stats(stMemStats_t *st);
+/* debug allocator call sites, returns how many */
+int mem_sites(stMemSite_t *sites, int max);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+#include "utypes.h"
+#include "timer.h"
+#include "event.h"
+
+#include <jansson.h>
+
+/*
+ * Event pipelines.  A pipe is a chain of stages in front of a sink (the
+ * queue of the module that takes the events).  Events travel as a batch,
+ * an array of stEvent_t pointers that every stage filters in place and
+ * hands on, so a stage never copies an event.  A stage that holds events
+ * (ratelimit shaping) gives them back through drain when the pipe timer
+ * it armed with pipe_wake fires.  An empty pipe calls the sink directly.
+ *
+ * Stages come from the "pipeline" item of the config file, keyed by the
+ * pipe name, a stage is { "stage": <type>, <options of the type> }:
+ *   { "config": { "pipeline": {
+ *       "up":   [ { "stage": "dedup", "window": 500 },
+ *                 { "stage": "filter", "topics": [ "DS." ] } ],
+ *       "down": [ { "stage": "ratelimit", "rate": 200, "policy": "police" } ] } } }
+ * Types: "filter" (a filter.h spec), "dedup" ("window" ms), "ratelimit"
+ * ("rate", "burst", "policy", "queue" as on a route).
+ */
+#define PIPE_BATCH		64		/* events a drain hands on at once */
+
+typedef struct stPipe stPipe_t;
+typedef struct stPipeStage stPipeStage_t;
+
+typedef struct stPipeOps {
+	const char *name;
+	int (*init)(stPipeStage_t *s, json_t *conf);
+	/* keep, hold or drop the n events of ev in place, returns how many go on */
+	int (*push)(stPipeStage_t *s, stEvent_t **ev, int n);
+	/* release up to n held events into ev, NULL if the stage never holds */
+	int (*drain)(stPipeStage_t *s, stEvent_t **ev, int n);
+	void (*free)(stPipeStage_t *s);
+}stPipeOps_t;
+
+struct stPipeStage {
+	const stPipeOps_t *ops;
+	stPipeStage_t *next;
+	stPipe_t *pipe;
+	void *priv;
+	u64 in;
+	u64 out;
+	u64 dropped;
+};
+
+struct stPipe {
+	const char *name;
+	int dir;		/* ROUTE_SUB: ubus -> link, ROUTE_PUB: link -> ubus */
+	stPipe_t *next;	/* pipes known to the config */
+	stPipeStage_t *head;
+	stPipeStage_t *tail;
+	int count;
+	struct timer timer;
+	struct timer_head *th;
+	int (*sink)(stEvent_t *e);
+};
+
+void pipe_init(stPipe_t *p, const char *name, int dir, struct timer_head *th,
+							 int (*sink)(stEvent_t *e));
+void pipe_free(stPipe_t *p);
+/* append a stage of type name, conf are its options */
+int pipe_add(stPipe_t *p, const char *name, json_t *conf);
+/* takes e */
+int pipe_push(stPipe_t *p, stEvent_t *e);
+/* takes the events of ev, the array itself is reused as the batch */
+int pipe_push_batch(stPipe_t *p, stEvent_t **ev, int n);
+/* for stages: have drain called in ms */
+void pipe_wake(stPipeStage_t *s, u32 ms);
+
+/* conf_io set handler of the "pipeline" item */
+int pipe_conf_set(json_t *obj);
+
+#endif
@@ -35,4 +35,12 @@ int platform_crypto_init_rsa(struct crypto_state *state,
 int platform_crypto_init_aes(struct crypto_state *state,
 	const u8 *iv, const u8 *key, size_t key_len);
 
+/*
+ * Initialize a custom crypto context for AES GCM authenticated encryption.
+ * The message layout and nonce rules are the ones of crypto_init_aes_gcm().
+ * Return 0 for success, and -1 for failure or if not implemented.
+ */
+int platform_crypto_init_aes_gcm(struct crypto_state *state,
+	const u8 *key, size_t key_len);
+
 #endif /* __AYLA_PLATFORM_CRYPTO_H__ */
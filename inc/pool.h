@@ -0,0 +1,32 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <utypes.h>
+
+/*
+ * Size class allocator for events.  Each class carves POOL_SLAB byte slabs
+ * into blocks, freed blocks go on a free list of the freeing thread and
+ * are handed out again without touching malloc.  Slabs are kept for the
+ * life of the process, so the pool settles at the high-water mark of
+ * each class instead of fragmenting the heap.  Larger requests fall back
+ * to malloc.
+ */
+#define POOL_NCLASS		4
+#define POOL_SIZES		{ 128, 256, 1024, 4096 }
+#define POOL_SLAB			(16 * 1024)
+
+typedef struct stPoolStats {
+	u32 size;			/* 0 -> over the last class, plain malloc */
+	u32 in_use;
+	u32 high;			/* most blocks in use at once */
+	u32 slabs;
+	u64 allocs;
+	u64 hits;			/* allocs served from a free list */
+}stPoolStats_t;
+
+void *pool_alloc(size_t size);
+void pool_free(void *p);
+/* one entry per class and one for the fallback, returns how many */
+int pool_stats(stPoolStats_t *st, int max);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _RATELIMIT_H_
+#define _RATELIMIT_H_
+
+#include "utypes.h"
+#include "timer.h"
+#include "list.h"
+#include "event.h"
+
+enum {
+	RATE_SHAPE = 0,	/* hold what is over the limit in a bounded queue */
+	RATE_POLICE,		/* drop what is over the limit */
+};
+
+#define RATE_QUEUE_MAX	256	/* default bound of a shaping queue */
+
+/*
+ * Token bucket on the monotonic clock, rate tokens per second up to burst.
+ * Tokens are kept in 1/1000 units and only refilled when they run short,
+ * so a sender under its limit reads the clock once per bucket, not once
+ * per event.  charge may run the bucket into debt, which wait then
+ * reports as time to recover.
+ */
+typedef struct stTokenBucket {
+	u32 rate;	/* 0 -> unlimited */
+	u32 burst;
+	s64 tokens;
+	u64 last;
+}stTokenBucket_t;
+
+void tbucket_init(stTokenBucket_t *tb, u32 rate, u32 burst);
+/* 1 -> n tokens taken, 0 -> over the limit, nothing taken */
+int tbucket_take(stTokenBucket_t *tb, u32 n);
+void tbucket_charge(stTokenBucket_t *tb, u32 n);
+/* ms until the bucket is out of debt, 0 -> now */
+u32 tbucket_wait(stTokenBucket_t *tb);
+
+/* an event stage in front of out(), one token per event */
+typedef struct stRateLimit {
+	stTokenBucket_t tb;
+	int policy;
+	int qmax;
+	stIList_t hold;	/* of stEvent_t.node */
+	int held;
+	struct timer timer;
+	struct timer_head *th;
+	int (*out)(stEvent_t *e);
+	unsigned int passed;
+	unsigned int delayed;
+	unsigned int dropped;
+}stRateLimit_t;
+
+void ratelimit_init(stRateLimit_t *rl, struct timer_head *th,
+										u32 rate, u32 burst, int policy, int qmax,
+										int (*out)(stEvent_t *e));
+void ratelimit_free(stRateLimit_t *rl);
+/* takes e, returns -1 if it was dropped */
+int ratelimit_push(stRateLimit_t *rl, stEvent_t *e);
+
+/* for callers that run the hold queue themselves (th and out NULL):
+ * admit takes e, 1 -> e passes now, 0 -> held, -1 -> dropped */
+int ratelimit_admit(stRateLimit_t *rl, stEvent_t *e);
+/* the oldest held event once a token is there, else NULL */
+stEvent_t *ratelimit_release(stRateLimit_t *rl);
+/* ms until the next held event may go */
+u32 ratelimit_retry(stRateLimit_t *rl);
+
+#endif
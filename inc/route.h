@@ -0,0 +1,68 @@
+#ifndef _ROUTE_H_
+#define _ROUTE_H_
+
+#include "frame.h"
+#include "ratelimit.h"
+
+#include <libubus.h>
+
+/*
+ * Routing table of the bridge.  SUB routes forward ubus events matching
+ * pattern to the link on chan, PUB routes publish frames received on chan
+ * as ubus events.  A pattern ending in '*' is a prefix wildcard, frames of
+ * a wildcard route carry the concrete topic (FRAME_TOPIC).  "prio" is
+ * "high", "normal" (default) or "bulk", a "PRIO" number next to the PKT
+ * of a single ubus event overrides it for that event.
+ *
+ * A SUB route may be limited to "rate" events per second ("burst" deep),
+ * "policy" "shape" (default) holds up to "queue" events over the limit,
+ * "police" drops them.
+ *
+ * conf_io file:
+ *   { "config": { "routes": {
+ *       "subscribe": [ { "pattern": "DS.*", "chan": 1, "prio": "high" } ],
+ *       "publish":   [ { "pattern": "DS.GREENPOWER", "chan": 2, "batch": true } ] } } }
+ * The "pipeline" item of the same file is loaded with it, see pipe.h.
+ */
+enum {
+	ROUTE_SUB = 0,
+	ROUTE_PUB,
+};
+
+typedef struct stRoute {
+	struct ubus_event_handler handler;	/* SUB only, one per pattern */
+	struct stRoute *next;
+	char *pattern;
+	int plen;		/* prefix length of a wildcard pattern */
+	int wild;
+	int chan;
+	int dir;
+	int batch;	/* PUB consumers accept "PKTS" arrays */
+	int prio;		/* EVENT_PRIO_* of the route's events */
+	stRateLimit_t rl;	/* SUB only, rate 0 passes everything */
+}stRoute_t;
+
+int route_init(void);
+void route_free(void);
+int route_add(const char *pattern, int chan, int dir);
+/* read the "routes" item of a conf_io config file */
+int route_conf_load(const char *path);
+int route_count(void);
+
+/* register every SUB route with ubus, cb sees the route via route_of() */
+int route_register(struct ubus_context *ctx, ubus_event_handler_t cb);
+/* arm the limiters of the SUB routes, events that pass go to out */
+void route_limit_start(struct timer_head *th, int (*out)(stEvent_t *e));
+static inline stRoute_t *route_of(struct ubus_event_handler *ev) {
+	return CONTAINER_OF(stRoute_t, handler, ev);
+}
+stRoute_t *route_get(const char *pattern);
+/* stops early and returns what func returned if it is non zero */
+int route_foreach(int (*func)(stRoute_t *r, void *arg), void *arg);
+/* PUB route of a channel, NULL if the channel is not published */
+stRoute_t *route_pub(int chan);
+/* first SUB route feeding a channel */
+stRoute_t *route_sub(int chan);
+bool route_match(const stRoute_t *r, const char *topic);
+
+#endif
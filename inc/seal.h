@@ -0,0 +1,68 @@
+#ifndef _SEAL_H_
+#define _SEAL_H_
+
+#include "utypes.h"
+#include "crypto.h"
+
+/*
+ * Authenticated record layer for the link, below the codec.  What a
+ * connection sends between two POLLOUT flushes becomes one record:
+ *   [u32 be length][nonce | ciphertext | tag]
+ * sealed with AES GCM (crypto_init_aes_gcm), so a batch of frames costs
+ * one nonce and one tag.  A record that fails to open closes the
+ * connection.
+ *
+ * Both ends load the same link key with -K but never seal with it.  Each
+ * end opens its stream with a random salt in clear, the peer seals what
+ * it sends towards that end under HKDF(key, salt, "c2s" or "s2c").  Keys
+ * are fresh per connection and per direction, so records replayed from
+ * another connection or reflected back to their sender do not open.
+ * What is sent before the peer's salt arrives is held in the batch.
+ */
+#define SEAL_REC_HDR		4
+#define SEAL_REC_MAX		(1024 * 1024)	/* sealed bytes of one record */
+#define SEAL_SALT_LEN		16
+
+enum {
+	SEAL_C2S = 0,	/* client to server */
+	SEAL_S2C,
+};
+
+typedef struct stSeal {
+	struct crypto_state cs;
+	int dir;					/* SEAL_C2S or SEAL_S2C, what the instance carries */
+	int keyed;
+	u8 salt[SEAL_SALT_LEN];	/* tx: our salt, ahead of the first record */
+	int salt_sent;
+	struct stSeal *peer;	/* rx: the tx side the peer's salt keys */
+	char *buf;				/* tx: open batch, rx: opened record */
+	unsigned int len;
+	unsigned int size;
+	char *rbuf;				/* rx: bytes of the partial record */
+	unsigned int rlen;
+	unsigned int rsize;
+	u64 records;
+	u64 failed;
+}stSeal_t;
+
+/* key file: 16, 24 or 32 raw bytes or the same in hex */
+int seal_key_load(const char *path);
+int seal_enabled(void);
+
+/* the two halves of a connection, dir is the one tx carries,
+ * -1 and both NULL when no key is loaded or on failure */
+int seal_pair(stSeal_t **tx, stSeal_t **rx, int dir);
+void seal_free(stSeal_t *s);
+
+/* add plaintext to the open batch */
+int seal_put(stSeal_t *s, const void *in, unsigned int len);
+/* seal the open batch, *out is MALLOC'ed and NULL if there was nothing */
+int seal_flush(stSeal_t *s, char **out, unsigned int *olen);
+/* seal in as a record of its own */
+int seal_record(stSeal_t *s, const void *in, unsigned int len,
+								char **out, unsigned int *olen);
+/* feed wire bytes, sink gets the plaintext of every complete record */
+int seal_open(stSeal_t *s, const void *in, unsigned int len,
+							int (*sink)(void *arg, const void *buf, unsigned int len), void *arg);
+
+#endif
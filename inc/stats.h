@@ -0,0 +1,81 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "utypes.h"
+#include "event.h"
+#include "frame.h"
+#include "timer.h"
+
+/*
+ * Bridge counters.  The bridge runs a single reactor thread, so the hot
+ * path bumps plain counters with no locks or atomics and a ubus call
+ * reads them from the same thread.  Rates are recomputed once a second.
+ */
+enum {
+	STATS_UP = 0,		/* ubus -> link */
+	STATS_DOWN,			/* link -> ubus */
+	STATS_DIRS,
+};
+
+#define STATS_LAT_BUCKETS	24	/* log2 buckets of us, up to ~8 s */
+#define STATS_RATE_MS			1000
+
+typedef struct stStatsDir {
+	u64 in_msgs;
+	u64 in_bytes;
+	u64 out_msgs;
+	u64 out_bytes;
+	u64 drops;
+	/* previous second, for the rates */
+	u64 last_msgs;
+	u64 last_bytes;
+	u32 msg_rate;
+	u32 byte_rate;
+}stStatsDir_t;
+
+typedef struct stStats {
+	stStatsDir_t chan[CHAN_MAX][STATS_DIRS];
+	u32 lat[STATS_DIRS][STATS_LAT_BUCKETS];
+	struct timer timer;
+	struct timer_head *th;
+}stStats_t;
+
+extern stStats_t stats;
+
+void stats_init(struct timer_head *th);
+u32  stats_percentile(int dir, int pct);
+struct blob_buf;
+void stats_dump(struct blob_buf *b);
+
+static inline stStatsDir_t *stats_dir(int dir, int chan) {
+	if (chan < 0 || chan >= CHAN_MAX) {
+		chan = CHAN_CTRL;
+	}
+	return &stats.chan[chan][dir];
+}
+
+static inline void stats_in(int dir, int chan, int len) {
+	stStatsDir_t *sd = stats_dir(dir, chan);
+	sd->in_msgs++;
+	sd->in_bytes += len;
+}
+
+static inline void stats_drop(int dir, int chan) {
+	stats_dir(dir, chan)->drops++;
+}
+
+/* the event left the bridge, account its time spent queued */
+static inline void stats_out(int dir, stEvent_t *e) {
+	stStatsDir_t *sd = stats_dir(dir, e->chan);
+	u64 us = event_now_us() - e->ts;
+	int b = us ? 64 - __builtin_clzll(us) : 0;
+
+	sd->out_msgs++;
+	sd->out_bytes += e->len;
+	if (b >= STATS_LAT_BUCKETS) {
+		b = STATS_LAT_BUCKETS - 1;
+	}
+	stats.lat[dir][b]++;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _STATS_DUMP_H_
+#define _STATS_DUMP_H_
+
+#include "chanq.h"
+#include "pipe.h"
+#include "codec.h"
+#include "seal.h"
+#include "buffer.h"
+
+#include <libubus.h>
+
+/*
+ * The "ubus2net" ubus object, a read-only view of the counters:
+ *   stats    channel counters, dedup, limits, allocators and pipes
+ *   queues   the ubus and link event queues
+ *   clients  one table per link connection, filled by the side
+ * Everything not shared by both ends comes from the hooks, they add
+ * their items to b.
+ */
+typedef struct stStatsDump {
+	stPipe_t *up;
+	stPipe_t *down;
+	stChanQueue_t *link;	/* events queued for the link */
+	void (*queues)(struct blob_buf *b);	/* NULL -> nothing to add */
+	void (*clients)(struct blob_buf *b);
+}stStatsDump_t;
+
+/* registers the object on ctx, sd must outlive it */
+int stats_dump_init(struct ubus_context *ctx, const stStatsDump_t *sd);
+
+/* for the clients hook */
+void stats_dump_rx(struct blob_buf *b, const struct queue_buf *qb,
+									 const struct queue_buf_pool *pool);
+void stats_dump_codec(struct blob_buf *b, stCodec_t *tx, stCodec_t *rx, stSeal_t *seal);
+
+#endif
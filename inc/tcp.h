@@ -1,11 +1,87 @@
-#ifndef __TCP_H_
-#define __TCP_H_
-
-/* type 0 ->client , 1 ->server */
-int tcp_init(int type, const char *ip, int port);
-int tcp_free(int fd);
-int tcp_recv(int fd, char *_buf, unsigned int _size, int _s, int _u);
-int tcp_send(int fd, char *_buf, unsigned int _size, int _s, int _u);
-int tcp_accept(int fd, int _s, int _u);
-
-#endif
+#ifndef __TCP_H_
+#define __TCP_H_
+
+/* type 0 ->client , 1 ->server */
+int tcp_init(int type, const char *ip, int port);
+int tcp_free(int fd);
+int tcp_recv(int fd, char *_buf, unsigned int _size, int _s, int _u);
+int tcp_send(int fd, char *_buf, unsigned int _size, int _s, int _u);
+int tcp_accept(int fd, int _s, int _u);
+
+/* non-blocking family, sockets are polled by the caller: 0 -> would block */
+int tcp_nonblock(int fd);
+int tcp_connect_nb(const char *ip, int port);
+/* 1 -> connected, 0 -> still in progress, < 0 -> failed (errno set) */
+int tcp_connect_done(int fd);
+int tcp_recv_nb(int fd, char *_buf, unsigned int _size);
+int tcp_send_nb(int fd, char *_buf, unsigned int _size);
+int tcp_accept_nb(int fd);
+
+/* scatter read into the queue_buf tail, 0 -> nothing to read */
+struct queue_buf;
+int tcp_readv(int fd, struct queue_buf *qb, unsigned int _size);
+
+/* zero copy send, payloads smaller than this are copied */
+#define TCP_ZC_THRESHOLD	(16 * 1024)
+
+/* a buffer pinned by the kernel, sent with ids [id, id + count) */
+typedef struct stTcpZcPend {
+	struct stTcpZcPend *next;
+	unsigned int id;
+	unsigned int count;
+	unsigned int left;	/* ids not completed yet */
+	int busy;						/* still being written */
+	void (*release)(void *);
+	void *arg;
+}stTcpZcPend_t;
+
+typedef struct stTcpZc {
+	int fd;
+	int enable;
+	unsigned int id;
+	int pending;
+	stTcpZcPend_t *head;
+	stTcpZcPend_t *tail;
+}stTcpZc_t;
+
+int tcp_zc_init(stTcpZc_t *zc, int fd);
+/* reap completions from the socket error queue, call on POLLERR */
+int tcp_zc_complete(stTcpZc_t *zc);
+void tcp_zc_free(stTcpZc_t *zc);
+
+/* per connection output backlog for non-blocking sockets, buffers are
+ * referenced not copied and written in order as POLLOUT allows */
+typedef struct stTcpOutBuf {
+	stTcpZcPend_t pend;	/* first, handed to the zerocopy list once written */
+	struct stTcpOutBuf *next;
+	char *buf;
+	unsigned int size;
+	unsigned int off;
+	int zc;
+}stTcpOutBuf_t;
+
+struct stCodec;
+struct stSeal;
+
+typedef struct stTcpOut {
+	stTcpZc_t zc;
+	stTcpOutBuf_t *head;
+	stTcpOutBuf_t *tail;
+	int count;
+	unsigned int bytes;
+	/* optional stream encoder, sends feed it and flush writes the batch */
+	struct stCodec *codec;
+	/* optional record sealing, applied to what the codec flushes */
+	struct stSeal *seal;
+}stTcpOut_t;
+
+int tcp_out_init(stTcpOut_t *out, int fd);
+/* returns bytes still queued (> 0 -> wait for POLLOUT), < 0 on error */
+int tcp_out_send(stTcpOut_t *out, char *_buf, unsigned int _size,
+								 void (*release)(void *), void *arg);
+int tcp_out_flush(stTcpOut_t *out);
+/* bytes queued plus those held in the open codec and seal batches */
+unsigned int tcp_out_backlog(stTcpOut_t *out);
+void tcp_out_free(stTcpOut_t *out);
+
+#endif
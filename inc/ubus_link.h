@@ -0,0 +1,53 @@
+#ifndef _UBUS_LINK_H_
+#define _UBUS_LINK_H_
+
+#include "utypes.h"
+#include "timer.h"
+#include "event.h"
+#include "frame.h"
+#include "chanq.h"
+#include "dedup.h"
+
+#include <libubus.h>
+
+/*
+ * The ubus side of the bridge, the same on both ends.  Events of the SUB
+ * routes go through dedup and the route limiter to up, the first stage
+ * of the link.  ubus_push queues link frames for the PUB routes, a route
+ * that accepts batches gets its PKTs as "PKTS" arrays of one topic.
+ */
+#define UBUS_QUANTUM			1024
+#define UBUS_BATCH_BYTES	8192	/* flush a PKTS batch at this size */
+#define UBUS_BATCH_MS			5			/* or when its first PKT is this old */
+#define UBUS_BATCH_BUDGET	256		/* events drained per step while batching */
+#define UBUS_TOPIC_MAX		128
+
+/* PKTS array being built for a publish route that accepts batches */
+typedef struct stUbusBatch {
+	struct blob_buf b;
+	void *cookie;
+	char topic[UBUS_TOPIC_MAX];
+	int count;
+	int bytes;
+	struct timer timer;
+}stUbusBatch_t;
+
+typedef struct stUbusEnv {
+	struct ubus_context *ubus_ctx;
+	struct file_event_table *fet;
+	struct timer_head *th;
+	struct timer step_timer;
+	stChanQueue_t eq;
+	stUbusBatch_t batch[CHAN_MAX];
+	stDedup_t dedup;
+}stUbusEnv_t;
+
+extern stUbusEnv_t ue;
+
+int ubus_init(void *_th, void *_fet, int dedup_window, int (*up)(stEvent_t *e));
+/* takes e, a link frame for a PUB route */
+int ubus_push(stEvent_t *e);
+/* PKTs waiting in open batches */
+int ubus_batched(void);
+
+#endif
@@ -15,11 +15,23 @@
 #include "common.h"
 #include "lockqueue.h"
 #include "tcp.h"
+#include "event.h"
+#include "frame.h"
+#include "chanq.h"
+#include "heartbeat.h"
+#include "route.h"
+#include "stats.h"
+#include "codec.h"
+#include "seal.h"
+#include "pipe.h"
+#include "ubus_link.h"
+#include "stats_dump.h"
 
 #include "log.h"
 #include "timer.h"
 #include "file_event.h"
 #include "json_parser.h"
+#include "buffer.h"
 
 #include <libubox/blobmsg_json.h>
 #include <libubox/avl.h>
@@ -40,6 +52,24 @@ static int ds_child_died = 0;
 struct timer_head th = {
 	.first = NULL,
 };
+
+static int hb_interval = HEARTBEAT_INTERVAL;
+static int hb_limit = HEARTBEAT_LIMIT;
+static int dedup_window = 0;
+static const char *link_codec = NULL;	/* e.g. "deflate", NULL -> plain link */
+static const char *dict_path = NULL;
+static const char *key_path = NULL;	/* link key, both ends seal with it */
+static const char *conf_path = NULL;
+
+int clie_push(stEvent_t *e);
+static stPipe_t up_pipe;		/* ubus events on their way to the link */
+static stPipe_t down_pipe;	/* link frames on their way to ubus */
+static int up_push(stEvent_t *e) {
+	return pipe_push(&up_pipe, e);
+}
+static const char *sub_spec = NULL;
+static const char *svr_addr = "192.168.0.230";
+static int verbose = 0;	/* debug logs, with every ubus event as json */
 ///////////////////////////////////////////////////////////////
 static void ds_child_exit_handler(int s) {
 	ds_child_died = 1;
@@ -74,10 +104,73 @@ static void sig_set() {
 	atexit(ds_exit_handler);
 }
 
+static void usage(const char *name) {
+	printf("usage: %s [-c routes.conf] [-a server] [-s subscription] [-b heartbeat_ms] [-k missed_beats] [-w dedup_ms] [-z codec] [-D dict] [-K key] [-v]\n", name);
+}
+
 int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "c:a:s:b:k:w:z:D:K:vh")) != -1) {
+		switch (opt) {
+			case 'c':
+				conf_path = optarg;
+				break;
+			case 'a':
+				svr_addr = optarg;
+				break;
+			case 's':
+				sub_spec = optarg;
+				break;
+			case 'b':
+				hb_interval = atoi(optarg);
+				break;
+			case 'k':
+				hb_limit = atoi(optarg);
+				break;
+			case 'w':
+				dedup_window = atoi(optarg);
+				break;
+			case 'z':
+				link_codec = optarg;
+				break;
+			case 'D':
+				dict_path = optarg;
+				break;
+			case 'K':
+				key_path = optarg;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
 	sig_set();
 
-	log_init(argv[0], LOG_OPT_DEBUG | LOG_OPT_CONSOLE_OUT | LOG_OPT_TIMESTAMPS | LOG_OPT_FUNC_NAMES);
+	log_init(argv[0], (verbose ? LOG_OPT_DEBUG : 0) | LOG_OPT_CONSOLE_OUT | LOG_OPT_TIMESTAMPS | LOG_OPT_FUNC_NAMES);
+
+	if (dict_path != NULL && codec_dict_load(dict_path) < 0) {
+		return 1;
+	}
+	if (key_path != NULL && seal_key_load(key_path) < 0) {
+		return 1;
+	}
+
+	pipe_init(&up_pipe, "up", ROUTE_SUB, &th, clie_push);
+	pipe_init(&down_pipe, "down", ROUTE_PUB, &th, ubus_push);
+	route_init();
+	if (conf_path != NULL) {
+		if (route_conf_load(conf_path) < 0 || route_count() == 0) {
+			log_err("no routes loaded from %s", conf_path);
+			return 1;
+		}
+	} else {
+		route_add("DS.GREENPOWER", 2, ROUTE_SUB);
+		route_add("DS.GATEWAY", 1, ROUTE_PUB);
+	}
 
 	while (1) {
 		ubus2net();
@@ -86,8 +179,8 @@ int main(int argc, char *argv[]) {
 }
 
 ////////////////////////////////////////////////////////////////
-int ubus_init(void *_th, void *_fet);
 int clie_init(void *_th, void *_fet);
+int ubus_dump_init(void);
 
 void timerout_cb(struct timer *t) {
 	log_info("========================api test==================");
@@ -102,8 +195,9 @@ void ubus2net() {
 	struct file_event_table fet;
 	file_event_init(&fet);
 
-	ubus_init(&th, &fet);
+	ubus_init(&th, &fet, dedup_window, up_push);
 	clie_init(&th, &fet);
+	ubus_dump_init();
 
 	while (1) {
 		s64 next_timeout_ms;
@@ -114,160 +208,117 @@ void ubus2net() {
 	}
 }
 
-/* Event */
-typedef struct stEvent {
-	int type;
-	int len;
-	void *data;
-}stEvent_t;
-
-stEvent_t *event_packet(int _type, int _len, void *data) {
-	stEvent_t *p = (stEvent_t *)MALLOC(sizeof(stEvent_t) + _len);
-	p->type = _type;
-	p->len = _len;
-	p->data = p+1;
-	if (_len > 0 && data != NULL) {
-		memcpy(p->data, data, p->len);
-	}
-	return p;
-}
-
-/* module ubus */
-typedef struct stUbusEnv {
-	struct ubus_context *ubus_ctx;
-	struct ubus_event_handler listener;
-	struct file_event_table *fet;
-	struct timer_head *th;
-	struct timer step_timer;
-	stLockQueue_t eq;
-	
-}stUbusEnv_t;
-stUbusEnv_t ue;
-static struct blob_buf b;
-
-static void receive_ubus_event(struct ubus_context *ctx,
-															 struct ubus_event_handler *ev,
-															 const char *type, struct blob_attr *msg);
-void ubus_run(struct timer *timer);
-void ubus_in(void *arg, int fd);
-int clie_push(stEvent_t *e);
-
-
-int ubus_init(void *_th, void *_fet) {
-	ue.th = _th;
-	ue.fet = _fet;
-
-	timer_init(&ue.step_timer, ubus_run);
-
-	ue.ubus_ctx = ubus_connect(NULL);
-	memset(&ue.listener, 0, sizeof(ue.listener));
-	ue.listener.cb = receive_ubus_event;
-	ubus_register_event_handler(ue.ubus_ctx, &ue.listener, "DS.GREENPOWER");
-
-	file_event_reg(ue.fet, ue.ubus_ctx->sock.fd, ubus_in, NULL, NULL);
-
-	lockqueue_init(&ue.eq);
-
-	return 0;
-}
-
-int ubus_step() {
-	timer_cancel(ue.th, &ue.step_timer);
-	timer_set(ue.th, &ue.step_timer, 10);
-	return 0;
-}
-
-int ubus_push(stEvent_t *e) {
-	lockqueue_push(&ue.eq, e);
-	ubus_step();
-	return 0;
-}
-
-void ubus_run(struct timer *timer) {
-	stEvent_t *e;
-	if (!lockqueue_pop(&ue.eq, (void**)&e)) {
-		return;
-	}
-	if (e == NULL) {
-		return;
-	}
-	if (e->type == 0 && e->data != NULL) {
-		blob_buf_init(&b, 0);
-		blobmsg_add_string(&b, "PKT", (char*)e->data);
-		log_debug("ubus send:%s", (char*)e->data);
-		ubus_send_event(ue.ubus_ctx, "DS.GATEWAY", b.head);
-	}
-	
-	FREE(e);
-	
-	ubus_step();
-}
-void ubus_in(void *arg, int fd) {
-	ubus_handle_event(ue.ubus_ctx);
-}
-
-
-static void receive_ubus_event(struct ubus_context *ctx, struct ubus_event_handler *ev,
-			  const char *type, struct blob_attr *msg) {
-	char *str;
-
-	log_debug("-----------------[ubus msg]: handler ....-----------------");
-	str = blobmsg_format_json(msg, true);
-	if (str != NULL) {
-		log_debug("[ubus msg]: [%s]", str);
-
-		json_error_t error;
-		json_t *jmsg = json_loads(str, 0, &error);
-		if (jmsg != NULL) {
-			const char *spkt = json_get_string(jmsg, "PKT");
-			if (spkt != NULL) {
-				stEvent_t *e = event_packet(0, strlen(spkt)+1, (void*)spkt);
-				clie_push(e);
-			} else {
-				log_debug("not find 'PKT' item!");
-			}
-			json_decref(jmsg);
-		} else {
-			log_debug("error: on line %d: %s", error.line, error.text);
-		}
-		free(str);
-	} else {
-		log_debug("[ubus msg]: []");
-	}
-	log_debug("-----------------[ubus msg]: handler over-----------------");
-}
-
 
 /* module clie */
+#define CLIE_RECV_SIZE	2048
+#define CLIE_QUANTUM		1024
+#define CLIE_RETRY_MS		3000
+#define CLIE_CONN_MS		5000	/* non-blocking connect timeout */
+#define CLIE_OUT_MAX		(256 * 1024)
+#define CLIE_HOLD_MAX		1024	/* events held while the link is down */
+#define CLIE_BUDGET			64		/* events sent per step, one codec batch */
+#define CLIE_POOL_FREE		16		/* spare receive segments kept */
+
 typedef struct stClieEnv {
 	struct timer step_timer;
-	stLockQueue_t eq;
+	stChanQueue_t eq;
 	struct file_event_table *fet;
 	struct timer_head *th;
 
 	int fd;
+	int connected;
+	stTcpOut_t out;
+	stCodec_t *rx;	/* inbound decoder once agreed */
+	stSeal_t *rx_seal;	/* inbound records, with -K */
+	struct queue_buf qb;
+	struct queue_buf_pool rx_pool;
+	stHeartbeat_t hb;
+	struct timer conn_timer;
 }stClieEnv_t;
 
 stClieEnv_t ce;
 void clie_run(struct timer *timer);
 void clie_in(void *arg, int fd);
+int clie_frame(stEvent_t *e, void *arg);
+void clie_event(void *arg, int fd, int events);
+void clie_close();
+void clie_want_out(int on);
+void clie_connect(struct timer *timer);
+void clie_ping(stHeartbeat_t *hb);
+void clie_dead(stHeartbeat_t *hb);
+int clie_step();
 
 int clie_init(void *_th, void *_fet) {
 	ce.th = _th;
 	ce.fet = _fet;
+	ce.fd = -1;
 
 	timer_init(&ce.step_timer, clie_run);
-	lockqueue_init(&ce.eq);
+	timer_init(&ce.conn_timer, clie_connect);
+	chanq_init(&ce.eq, CLIE_QUANTUM);
+	queue_buf_pool_init(&ce.rx_pool, CLIE_RECV_SIZE, CLIE_POOL_FREE);
+	queue_buf_init(&ce.qb, 0, CLIE_RECV_SIZE);
+	queue_buf_set_pool(&ce.qb, &ce.rx_pool);
+	heartbeat_init(&ce.hb, ce.th, hb_interval, hb_limit, clie_ping, clie_dead, NULL);
+
+	clie_connect(&ce.conn_timer);
+	return ce.fd > 0 ? 0 : -1;
+}
+
+/* only poll for POLLOUT while connecting or while there is a backlog */
+void clie_want_out(int on) {
+	int mask = POLLIN | POLLPRI | POLLERR;
+	if (on) {
+		mask |= POLLOUT;
+	}
+	file_event_reg_pollf(ce.fet, ce.fd, clie_event, mask, NULL);
+}
 
-	ce.fd = tcp_init(0, "192.168.0.230", 19000);
+void clie_connect(struct timer *timer) {
+	if (ce.fd > 0) {
+		log_debug("connect to %s timeout!", svr_addr);
+		clie_close();
+		return;
+	}
+	ce.fd = tcp_connect_nb(svr_addr, 19000);
 	if (ce.fd > 0) {
-		file_event_reg(ce.fet, ce.fd, clie_in, NULL, NULL);
+		/* completion is reported as POLLOUT */
+		ce.connected = 0;
+		clie_want_out(1);
+		timer_set(ce.th, &ce.conn_timer, CLIE_CONN_MS);
 	} else {
-		log_debug("connect to 192.168.0.230 failed!");
-		return -1;
+		log_debug("connect to %s failed!", svr_addr);
+		ce.fd = -1;
+		timer_set(ce.th, &ce.conn_timer, CLIE_RETRY_MS);
 	}
+}
 
-	return 0;
+void clie_established() {
+	timer_cancel(ce.th, &ce.conn_timer);
+	log_info("connected to %s", svr_addr);
+	ce.connected = 1;
+	tcp_out_init(&ce.out, ce.fd);
+	if (seal_enabled() && seal_pair(&ce.out.seal, &ce.rx_seal, SEAL_C2S) < 0) {
+		log_err("link seal init failed");
+		clie_close();
+		return;
+	}
+	/* a sealed link opens with our salt */
+	clie_want_out(ce.out.seal != NULL);
+	/* the server filters what it forwards, see filter.h */
+	if (sub_spec != NULL && frame_send(&ce.out, FRAME_SUB, CHAN_CTRL, sub_spec, strlen(sub_spec) + 1) > 0) {
+		clie_want_out(1);
+	}
+	if (link_codec != NULL) {
+		char hello[CODEC_HELLO_MAX];
+		codec_hello_offer(hello, sizeof(hello), link_codec);
+		if (frame_send(&ce.out, FRAME_HELLO, CHAN_CTRL, hello, strlen(hello) + 1) > 0) {
+			clie_want_out(1);
+		}
+	}
+	heartbeat_start(&ce.hb);
+	/* replay what was held while the link was down */
+	clie_step();
 }
 
 int clie_step() {
@@ -277,63 +328,246 @@ int clie_step() {
 }
 
 int clie_push(stEvent_t *e) {
-	lockqueue_push(&ce.eq, e);
+	if (!ce.connected && chanq_size(&ce.eq) >= CLIE_HOLD_MAX) {
+		log_debug("link down, queue full: drop");
+		stats_drop(STATS_UP, e->chan);
+		event_put(e);
+		return -1;
+	}
+	chanq_push(&ce.eq, e);
 	clie_step();
 	return 0;
 }
 
 void clie_run(struct timer *timer) {
 	stEvent_t *e;
-	if (!lockqueue_pop(&ce.eq, (void**)&e) != 0) {
+	int budget = CLIE_BUDGET;
+	if (!ce.connected) {
 		return;
 	}
-	if (e == NULL) {
-		return;
-	}
-
-	log_debug("clie msg:%s", (char*)e->data);
-
-	if (e->type == 0 && e->data != NULL) {
-		int ret = tcp_send(ce.fd, e->data, e->len, 0, 8000);
-		if (ret <= 0) {
-			log_debug("socket error !, close it");
-
-			file_event_unreg(ce.fet, ce.fd, NULL, NULL, NULL);
+	/* a step sends a batch, the codec compresses it as one */
+	do {
+		if (tcp_out_backlog(&ce.out) > CLIE_OUT_MAX) {
+			return; //resumed from POLLOUT once the backlog drains
+		}
+		if (!chanq_pop(&ce.eq, &e)) {
+			return;
+		}
+		if (e == NULL) {
+			return;
+		}
 
-			tcp_free(ce.fd);
-			ce.fd = -1;
-		} 
-	}
+		log_debug("clie msg:%s", (char*)e->data);
+		stats_out(STATS_UP, e);
+
+		if ((e->type == FRAME_DATA || e->type == FRAME_TOPIC) && e->data != NULL) {
+			void *frame = frame_encode(e, e->type);
+			int ret = tcp_out_send(&ce.out, frame, e->len + FRAME_HDR_LEN,
+														 event_release, event_get(e));
+			if (ret < 0) {
+				log_debug("socket error !, close it");
+				clie_close();
+			} else if (ret > 0) {
+				clie_want_out(1);
+			}
+		}
 
+		event_put(e);
+	} while (ce.connected && --budget > 0);
 
-	FREE(e);
-	
 	clie_step();
 }
 
 void clie_in(void *arg, int fd) {
 	log_debug("[%s]", __func__);
 
-	char buf[1024];	
-	int ret = tcp_recv(ce.fd, buf, sizeof(buf), 0, 8000);
-	if (ret <= 0) {
+	int ret = codec_recv(ce.rx, ce.rx_seal, ce.fd, &ce.qb, CLIE_RECV_SIZE);
+	if (ret < 0) {
 		log_debug("socket error, recv: close it");
-		file_event_unreg(ce.fet, ce.fd, NULL, NULL, NULL);
-		tcp_free(ce.fd);
-		ce.fd = -1;
-	} else {
-		log_debug_hex("recv", buf, ret);
-		if (buf[ret-1] == '\n') {
-			buf[ret-1] = 0;
-			ret--;
-		} 
+		clie_close();
+		return;
+	}
+	if (ret > 0) {
+		heartbeat_feed(&ce.hb);
+	}
+	/* the server's salt releases what was sealed up waiting for it */
+	if (ce.out.seal != NULL && ce.out.seal->keyed && ce.out.seal->len > 0) {
+		clie_want_out(1);
+	}
 
-		buf[ret++] = 0;
-		log_debug("%s", buf);
+	for (;;) {
+		stCodec_t *rx = ce.rx;
+		if (frame_recv(&ce.qb, clie_frame, NULL) < 0) {
+			log_debug("frame error, recv: close it");
+			clie_close();
+			return;
+		}
+		/* a HELLO switched the rest of the stream to the codec */
+		if (ce.rx == rx) {
+			break;
+		}
+		if (codec_decode_qb(ce.rx, &ce.qb) < 0) {
+			log_debug("decode error, recv: close it");
+			clie_close();
+			return;
+		}
+	}
+}
 
-		stEvent_t *e = event_packet(0,  ret, buf);
-		ubus_push(e);
+/* the server's answer to our offer, returns 1 when the stream switches */
+int clie_hello(const char *spec) {
+	char hello[CODEC_HELLO_MAX];
+	const void *d = NULL;
+	unsigned int dlen = 0;
+	stCodec_t *tx;
+	int offer, dict;
+	const char *name = codec_hello_parse(spec, link_codec, &offer, &dict);
+
+	if (offer || name == NULL) {
+		log_info("link codec: none");
+		return 0;
+	}
+	if (dict) {
+		d = codec_dict(&dlen);
+	}
+	ce.rx = codec_new(name, 0, d, dlen);
+	tx = codec_new(name, 1, d, dlen);
+	if (ce.rx == NULL || tx == NULL) {
+		/* the server already encodes, so drop the link and come back plain */
+		log_err("link codec %s init failed, reconnect without it", name);
+		codec_free(ce.rx);
+		ce.rx = NULL;
+		codec_free(tx);
+		link_codec = NULL;
+		clie_close();
+		return 1;
 	}
+	/* echo the answer, everything we send after it is encoded */
+	codec_hello_answer(hello, sizeof(hello), name, dict);
+	if (frame_send(&ce.out, FRAME_HELLO, CHAN_CTRL, hello, strlen(hello) + 1) > 0) {
+		clie_want_out(1);
+	}
+	ce.out.codec = tx;
+	log_info("link codec: %s%s", name, dict ? " with dictionary" : "");
+	return 1;
+}
+
+int clie_frame(stEvent_t *e, void *arg) {
+	int ret;
+	switch (e->type) {
+		case FRAME_DATA:
+		case FRAME_TOPIC:
+			stats_in(STATS_DOWN, e->chan, e->len);
+			return pipe_push(&down_pipe, e);
+		case FRAME_PING:
+			if (frame_send_ctrl(&ce.out, FRAME_PONG) > 0) {
+				clie_want_out(1);
+			}
+			break;
+		case FRAME_HELLO:
+			ret = clie_hello((const char *)e->data);
+			event_put(e);
+			return ret;
+		default:
+			break;
+	}
+	event_put(e);
+	return 0;
+}
+
+void clie_ping(stHeartbeat_t *hb) {
+	int ret = frame_send_ctrl(&ce.out, FRAME_PING);
+	if (ret < 0) {
+		log_debug("ping failed");
+	} else if (ret > 0) {
+		clie_want_out(1);
+	}
+}
+
+void clie_dead(stHeartbeat_t *hb) {
+	log_warn("server missed %d heartbeats, close it", hb->missed);
+	clie_close();
+}
+
+void clie_event(void *arg, int fd, int events) {
+	if (!ce.connected) {
+		int ret = tcp_connect_done(fd);
+		if (ret < 0) {
+			log_debug("connect to %s failed!", svr_addr);
+			clie_close();
+		} else if (ret > 0) {
+			clie_established();
+		}
+		return;
+	}
+	if (events & POLLERR) {
+		int ret = tcp_zc_complete(&ce.out.zc);
+		if (ret <= 0 && !(events & POLLIN)) {
+			log_debug("socket error, errqueue: close it");
+			clie_close();
+			return;
+		}
+	}
+	if (events & POLLOUT) {
+		int ret = tcp_out_flush(&ce.out);
+		if (ret < 0) {
+			log_debug("socket error, send: close it");
+			clie_close();
+			return;
+		}
+		if (ret == 0) {
+			clie_want_out(0);
+		}
+		if (ret <= CLIE_OUT_MAX) {
+			clie_step();
+		}
+	}
+	if (events & (POLLIN | POLLPRI | POLLHUP)) {
+		clie_in(arg, fd);
+	}
+}
+
+void clie_close() {
+	if (ce.fd <= 0) {
+		return;
+	}
+	file_event_unreg(ce.fet, ce.fd, NULL, NULL, NULL);
+	heartbeat_stop(&ce.hb);
+	if (ce.connected) {
+		tcp_out_free(&ce.out);
+	}
+	queue_buf_reset(&ce.qb);
+	codec_free(ce.rx);
+	ce.rx = NULL;
+	seal_free(ce.rx_seal);
+	ce.rx_seal = NULL;
+	tcp_free(ce.fd);
+	ce.fd = -1;
+	ce.connected = 0;
+	timer_set(ce.th, &ce.conn_timer, CLIE_RETRY_MS);
 }
 
+/* ubus2net object, the link side of the read-only view */
+static void ubus_clients_dump(struct blob_buf *b) {
+	void *tbl = blobmsg_open_table(b, NULL);
+	blobmsg_add_u32(b, "fd", ce.fd);
+	blobmsg_add_u8(b, "connected", ce.connected);
+	blobmsg_add_u32(b, "backlog_bytes", ce.out.bytes);
+	blobmsg_add_u32(b, "backlog_frames", ce.out.count);
+	blobmsg_add_u32(b, "zerocopy_pending", ce.out.zc.pending);
+	blobmsg_add_u32(b, "missed_beats", ce.hb.missed);
+	stats_dump_rx(b, &ce.qb, &ce.rx_pool);
+	stats_dump_codec(b, ce.connected ? ce.out.codec : NULL, ce.rx, ce.rx_seal);
+	blobmsg_close_table(b, tbl);
+}
+
+static const stStatsDump_t ubus_dump = {
+	.up = &up_pipe,
+	.down = &down_pipe,
+	.link = &ce.eq,
+	.clients = ubus_clients_dump,
+};
 
+int ubus_dump_init(void) {
+	return stats_dump_init(ue.ubus_ctx, &ubus_dump);
+}
@@ -10,16 +10,32 @@
 #include <limits.h>
 #include <errno.h>
 #include <time.h>
+#include <arpa/inet.h>
 
 
 #include "common.h"
 #include "lockqueue.h"
 #include "tcp.h"
+#include "event.h"
+#include "frame.h"
+#include "chanq.h"
+#include "heartbeat.h"
+#include "route.h"
+#include "filter.h"
+#include "stats.h"
+#include "codec.h"
+#include "seal.h"
+#include "pipe.h"
+#include "ubus_link.h"
+#include "stats_dump.h"
 
 #include "log.h"
 #include "timer.h"
 #include "file_event.h"
 #include "json_parser.h"
+#include "buffer.h"
+#include "hashmap.h"
+#include "async.h"
 
 #include <libubox/blobmsg_json.h>
 #include <libubox/avl.h>
@@ -40,6 +56,25 @@ static int ds_child_died = 0;
 struct timer_head th = {
 	.first = NULL,
 };
+
+static int hb_interval = HEARTBEAT_INTERVAL;
+static int hb_limit = HEARTBEAT_LIMIT;
+static int dedup_window = 0;
+static const char *link_codec = NULL;	/* e.g. "deflate", NULL -> plain link */
+static const char *dict_path = NULL;
+static const char *key_path = NULL;	/* link key, both ends seal with it */
+static int cli_rate = 0;	/* frames per second a client may push to ubus */
+static int cli_burst = 0;
+static int cli_policy = RATE_SHAPE;
+static const char *conf_path = NULL;
+static int verbose = 0;	/* debug logs, with every ubus event as json */
+
+int clie_push(stEvent_t *e);
+static stPipe_t up_pipe;		/* ubus events on their way to the link */
+static stPipe_t down_pipe;	/* link frames on their way to ubus */
+static int up_push(stEvent_t *e) {
+	return pipe_push(&up_pipe, e);
+}
 ///////////////////////////////////////////////////////////////
 static void ds_child_exit_handler(int s) {
 	ds_child_died = 1;
@@ -74,10 +109,76 @@ static void sig_set() {
 	atexit(ds_exit_handler);
 }
 
+static void usage(const char *name) {
+	printf("usage: %s [-c routes.conf] [-b heartbeat_ms] [-k missed_beats] [-w dedup_ms] [-l rate[/burst]] [-p] [-z codec] [-D dict] [-K key] [-v]\n", name);
+}
+
 int main(int argc, char *argv[]) {
+	int opt;
+	while ((opt = getopt(argc, argv, "c:b:k:w:l:pz:D:K:vh")) != -1) {
+		switch (opt) {
+			case 'c':
+				conf_path = optarg;
+				break;
+			case 'b':
+				hb_interval = atoi(optarg);
+				break;
+			case 'k':
+				hb_limit = atoi(optarg);
+				break;
+			case 'w':
+				dedup_window = atoi(optarg);
+				break;
+			case 'z':
+				link_codec = optarg;
+				break;
+			case 'D':
+				dict_path = optarg;
+				break;
+			case 'K':
+				key_path = optarg;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'l':
+				if (sscanf(optarg, "%d/%d", &cli_rate, &cli_burst) < 1 || cli_rate < 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'p':
+				cli_policy = RATE_POLICE;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
 	sig_set();
 
-	log_init(argv[0], LOG_OPT_DEBUG | LOG_OPT_CONSOLE_OUT | LOG_OPT_TIMESTAMPS | LOG_OPT_FUNC_NAMES);
+	log_init(argv[0], (verbose ? LOG_OPT_DEBUG : 0) | LOG_OPT_CONSOLE_OUT | LOG_OPT_TIMESTAMPS | LOG_OPT_FUNC_NAMES);
+
+	if (dict_path != NULL && codec_dict_load(dict_path) < 0) {
+		return 1;
+	}
+	if (key_path != NULL && seal_key_load(key_path) < 0) {
+		return 1;
+	}
+
+	pipe_init(&up_pipe, "up", ROUTE_SUB, &th, clie_push);
+	pipe_init(&down_pipe, "down", ROUTE_PUB, &th, ubus_push);
+	route_init();
+	if (conf_path != NULL) {
+		if (route_conf_load(conf_path) < 0 || route_count() == 0) {
+			log_err("no routes loaded from %s", conf_path);
+			return 1;
+		}
+	} else {
+		route_add("DS.GATEWAY", 1, ROUTE_SUB);
+		route_add("DS.GREENPOWER", 2, ROUTE_PUB);
+	}
 
 	while (1) {
 		ubus2net();
@@ -86,9 +187,10 @@ int main(int argc, char *argv[]) {
 }
 
 ////////////////////////////////////////////////////////////////
-int ubus_init(void *_th, void *_fet);
 int clie_init(void *_th, void *_fet);
+int ubus_dump_init(void);
 int serv_init(void *_th, void *_fet);
+int rpc_init(void *_th);
 
 void timerout_cb(struct timer *t) {
 	log_info("========================api test==================");
@@ -103,8 +205,10 @@ void ubus2net() {
 	struct file_event_table fet;
 	file_event_init(&fet);
 
-	ubus_init(&th, &fet);
+	ubus_init(&th, &fet, dedup_window, up_push);
 	clie_init(&th, &fet);
+	ubus_dump_init();
+	rpc_init(&th);
 	serv_init(&th, &fet);
 
 	while (1) {
@@ -116,132 +220,8 @@ void ubus2net() {
 	}
 }
 
-/* Event */
-typedef struct stEvent {
-	int type;
-	int len;
-	void *data;
-}stEvent_t;
-
-stEvent_t *event_packet(int _type, int _len, void *data) {
-	stEvent_t *p = (stEvent_t *)MALLOC(sizeof(stEvent_t) + _len);
-	p->type = _type;
-	p->len = _len;
-	p->data = p+1;
-	if (_len > 0 && data != NULL) {
-		memcpy(p->data, data, p->len);
-	}
-	return p;
-}
 int clie_push(stEvent_t *e);
 
-/* module ubus */
-
-typedef struct stUbusEnv {
-	struct ubus_context *ubus_ctx;
-	struct ubus_event_handler listener;
-	struct file_event_table *fet;
-	struct timer_head *th;
-	struct timer step_timer;
-	stLockQueue_t eq;
-	
-}stUbusEnv_t;
-stUbusEnv_t ue;
-static struct blob_buf b;
-
-static void receive_ubus_event(struct ubus_context *ctx,
-															 struct ubus_event_handler *ev,
-															 const char *type, struct blob_attr *msg);
-void ubus_run(struct timer *timer);
-void ubus_in(void *arg, int fd);
-
-
-int ubus_init(void *_th, void *_fet) {
-	ue.th = _th;
-	ue.fet = _fet;
-
-	timer_init(&ue.step_timer, ubus_run);
-
-	ue.ubus_ctx = ubus_connect(NULL);
-	memset(&ue.listener, 0, sizeof(ue.listener));
-	ue.listener.cb = receive_ubus_event;
-	ubus_register_event_handler(ue.ubus_ctx, &ue.listener, "DS.GATEWAY");
-
-	file_event_reg(ue.fet, ue.ubus_ctx->sock.fd, ubus_in, NULL, NULL);
-
-	lockqueue_init(&ue.eq);
-
-	return 0;
-}
-
-int ubus_step() {
-	timer_cancel(ue.th, &ue.step_timer);
-	timer_set(ue.th, &ue.step_timer, 10);
-	return 0;
-}
-
-int ubus_push(stEvent_t *e) {
-	lockqueue_push(&ue.eq, e);
-	ubus_step();
-	return 0;
-}
-
-void ubus_run(struct timer *timer) {
-	stEvent_t *e;
-	if (!lockqueue_pop(&ue.eq, (void**)&e)) {
-		return;
-	}
-	if (e == NULL) {
-		return;
-	}
-	if (e->type == 0 && e->data != NULL) {
-		blob_buf_init(&b, 0);
-		blobmsg_add_string(&b, "PKT", (char*)e->data);
-		log_debug("ubus send:%s", (char*)e->data);
-		ubus_send_event(ue.ubus_ctx, "DS.GREENPOWER", b.head);
-	}
-	
-	FREE(e);
-	
-	ubus_step();
-}
-void ubus_in(void *arg, int fd) {
-	ubus_handle_event(ue.ubus_ctx);
-}
-
-
-static void receive_ubus_event(struct ubus_context *ctx, struct ubus_event_handler *ev,
-			  const char *type, struct blob_attr *msg) {
-	char *str;
-
-	log_debug("-----------------[ubus msg]: handler ....-----------------");
-	str = blobmsg_format_json(msg, true);
-	if (str != NULL) {
-		log_debug("[ubus msg]: [%s]", str);
-
-		json_error_t error;
-		json_t *jmsg = json_loads(str, 0, &error);
-		if (jmsg != NULL) {
-			const char *spkt = json_get_string(jmsg, "PKT");
-			if (spkt != NULL) {
-				stEvent_t *e = event_packet(0, strlen(spkt)+1, (void*)spkt);
-				clie_push(e);
-			} else {
-				log_debug("not find 'PKT' item!");
-			}
-			json_decref(jmsg);
-		} else {
-			log_debug("error: on line %d: %s", error.line, error.text);
-		}
-		free(str);
-	} else {
-		log_debug("[ubus msg]: []");
-	}
-	log_debug("-----------------[ubus msg]: handler over-----------------");
-}
-
-
-
 /* module serv */
 typedef struct stServEnv {
 	struct timer step_timer;
@@ -266,6 +246,7 @@ int serv_init(void *_th, void *_fet) {
 
 	se.fd = tcp_init(1, "0.0.0.0", 19000);
 	if (se.fd > 0) {
+		tcp_nonblock(se.fd);
 		file_event_reg(ue.fet, se.fd, serv_in, NULL, NULL);
 	} else {
 		log_debug("tcp init failed!");
@@ -282,34 +263,62 @@ void serv_run(struct timer *timer) {
 	return;
 }
 void serv_in(void *arg, int fd) {
-	int ret = tcp_accept(fd, 0, 0);
+	int ret;
 	log_debug("[%s]", __func__);
-	if (ret > 0) {
+	while ((ret = tcp_accept_nb(fd)) > 0) {
 		log_debug("serv in ->add cli %d", ret);
 		clie_add_cli(ret);
 	}
 }
 
 /* module clie */
+#define CLIE_RECV_SIZE	2048
+#define CLIE_QUANTUM		1024
+#define CLIE_OUT_MAX		(256 * 1024)
+#define CLIE_BUDGET			64		/* events sent per step, one codec batch */
+#define CLIE_POOL_FREE		64		/* spare receive segments kept */
+
 typedef struct stClieEnv {
 	struct timer step_timer;
-	stLockQueue_t eq;
+	stChanQueue_t eq;
 	struct file_event_table *fet;
 	struct timer_head *th;
 
 	int cli[16];
+	stTcpOut_t out[16];
+	struct queue_buf qb[16];
+	struct queue_buf_pool rx_pool;	/* receive segments of all clients */
+	stHeartbeat_t hb[16];
+	stFilter_t filter[16];
+	stCodec_t *rx[16];	/* inbound decoders once agreed */
+	stSeal_t *rx_seal[16];	/* inbound records, with -K */
+	stTokenBucket_t tb[16];
+	struct timer rl_timer[16];
+	int paused[16];
+	unsigned int rl_dropped[16];
+	unsigned int rl_paused[16];
 }stClieEnv_t;
 
 stClieEnv_t ce;
 void clie_run(struct timer *timer);
+void clie_send(stEvent_t *e);
+int clie_hello(int i, const char *spec);
+void clie_in(void *arg, int fd);
+int clie_frame(stEvent_t *e, void *arg);
 int clie_del_cli(int fd);
+void clie_event(void *arg, int fd, int events);
+void clie_throttle(int i);
+void clie_resume(struct timer *timer);
+int rpc_request(int cli, stEvent_t *e);
+void rpc_detach(int cli);
 
 int clie_init(void *_th, void *_fet) {
 	ce.th = _th;
 	ce.fet = _fet;
 
 	timer_init(&ce.step_timer, clie_run);
-	lockqueue_init(&ce.eq);
+	chanq_init(&ce.eq, CLIE_QUANTUM);
+	queue_buf_pool_init(&ce.rx_pool, CLIE_RECV_SIZE, CLIE_POOL_FREE);
 
 	memset(ce.cli, 0, sizeof(ce.cli));
 
@@ -323,41 +332,78 @@ int clie_step() {
 }
 
 int clie_push(stEvent_t *e) {
-	lockqueue_push(&ce.eq, e);
+	chanq_push(&ce.eq, e);
 	clie_step();
 	return 0;
 }
 
-void clie_run(struct timer *timer) {
-	stEvent_t *e;
-	if (!lockqueue_pop(&ce.eq, (void**)&e) != 0) {
-		return;
+/* only poll for POLLOUT while there is a backlog, POLLHUP always: poll
+ * reports it unasked and file_event only dispatches what was asked for */
+void clie_want_out(int i, int on) {
+	int mask = POLLPRI | POLLERR | POLLHUP;
+	if (!ce.paused[i]) {
+		mask |= POLLIN;
 	}
-	if (e == NULL) {
-		return;
+	if (on) {
+		mask |= POLLOUT;
 	}
+	file_event_reg_pollf(ce.fet, ce.cli[i], clie_event, mask, NULL);
+}
+
+void clie_run(struct timer *timer) {
+	stEvent_t *e;
+	int budget = CLIE_BUDGET;
+	/* a step sends a batch, the codecs compress it as one */
+	do {
+		if (!chanq_pop(&ce.eq, &e)) {
+			return;
+		}
+		if (e == NULL) {
+			return;
+		}
+		clie_send(e);
+		event_put(e);
+	} while (--budget > 0);
 
+	clie_step();
+}
+
+void clie_send(stEvent_t *e) {
 	log_debug("clie msg:%s", (char*)e->data);
+	stats_out(STATS_UP, e);
 
-	if (e->type == 0 && e->data != NULL) {
+	if ((e->type == FRAME_DATA || e->type == FRAME_TOPIC) && e->data != NULL) {
+		void *frame = frame_encode(e, e->type);
+		stFilterCtx_t fctx;
 		int i;
+		filter_ctx_init(&fctx, e, ROUTE_SUB);
 		for (i = 0; i < sizeof(ce.cli)/sizeof(ce.cli[0]); i++) {
 			int ifd = ce.cli[i];
 			if (ifd <= 0) {
 				continue;
 			}
-			int ret = tcp_send(ifd, e->data, e->len, 0, 8000);
-			if (ret <= 0) {
+			if (!filter_match(&ce.filter[i], &fctx)) {
+				continue;
+			}
+			/* what sits in the codec and seal batches counts too */
+			unsigned int backlog = tcp_out_backlog(&ce.out[i]);
+			if (backlog > CLIE_OUT_MAX) {
+				log_debug("client %d backlog %u, drop frame", ifd, backlog);
+				stats_drop(STATS_UP, e->chan);
+				continue;
+			}
+			int ret = tcp_out_send(&ce.out[i], frame, e->len + FRAME_HDR_LEN,
+														 event_release, event_get(e));
+			if (ret < 0) {
 				log_debug("socket error !, close it");
 				clie_del_cli(ifd);
 				tcp_free(ifd);
-			} 
+			} else {
+				clie_want_out(i, ret > 0);
+			}
 		}
+		filter_ctx_free(&fctx);
 	}
-	
-	FREE(e);
-	
-	clie_step();
 }
 
 void clie_in(void *arg, int fd) {
@@ -377,24 +423,230 @@ void clie_in(void *arg, int fd) {
 	*/
 	log_debug("[%s]", __func__);
 
-	char buf[1024];	
-	int ret = tcp_recv(fd, buf, sizeof(buf), 0, 8000);
-	if (ret <= 0) {
+	int i;
+	for (i = 0; i < sizeof(ce.cli)/sizeof(ce.cli[0]); i++) {
+		if (ce.cli[i] == fd) {
+			break;
+		}
+	}
+	if (i >= sizeof(ce.cli)/sizeof(ce.cli[0])) {
+		return;
+	}
+
+	int ret = codec_recv(ce.rx[i], ce.rx_seal[i], fd, &ce.qb[i], CLIE_RECV_SIZE);
+	if (ret < 0) {
 		log_debug("socket error, recv: close it");
 		clie_del_cli(fd);
 		tcp_free(fd);
-	} else {
-		log_debug_hex("recv", buf, ret);
-		if (buf[ret-1] == '\n') {
-			buf[ret-1] = 0;
-			ret--;
-		} 
+		return;
+	}
+	if (ret > 0) {
+		heartbeat_feed(&ce.hb[i]);
+	}
+	/* the client's salt releases what was sealed up waiting for it */
+	if (ce.out[i].seal != NULL && ce.out[i].seal->keyed && ce.out[i].seal->len > 0) {
+		clie_want_out(i, 1);
+	}
 
-		buf[ret++] = 0;
-		log_debug("%s", buf);
+	for (;;) {
+		stCodec_t *rx = ce.rx[i];
+		if (frame_recv(&ce.qb[i], clie_frame, &ce.cli[i]) < 0) {
+			log_debug("frame error, recv: close it");
+			clie_del_cli(fd);
+			tcp_free(fd);
+			return;
+		}
+		/* a HELLO switched the rest of the stream to the codec */
+		if (ce.cli[i] != fd) {
+			return;	//dropped by a failed HELLO
+		}
+		if (ce.rx[i] == rx) {
+			break;
+		}
+		if (codec_decode_qb(ce.rx[i], &ce.qb[i]) < 0) {
+			log_debug("decode error, recv: close it");
+			clie_del_cli(fd);
+			tcp_free(fd);
+			return;
+		}
+	}
+	if (cli_policy == RATE_SHAPE) {
+		clie_throttle(i);
+	}
+}
 
-		stEvent_t *e = event_packet(0,  ret, buf);
-		ubus_push(e);
+/* shaping: stop reading a client in debt, TCP flow control holds the rest */
+void clie_throttle(int i) {
+	u32 ms = tbucket_wait(&ce.tb[i]);
+	if (ms == 0) {
+		return;
+	}
+	ce.paused[i] = 1;
+	ce.rl_paused[i]++;
+	clie_want_out(i, ce.out[i].count > 0);
+	timer_set(ce.th, &ce.rl_timer[i], ms < hb_interval ? ms : hb_interval);
+}
+
+void clie_resume(struct timer *timer) {
+	int i = timer - ce.rl_timer;
+	u32 ms;
+
+	/* the peer is not silent, we are not listening */
+	heartbeat_feed(&ce.hb[i]);
+	ms = tbucket_wait(&ce.tb[i]);
+	if (ms > 0) {
+		timer_set(ce.th, timer, ms < hb_interval ? ms : hb_interval);
+		return;
+	}
+	ce.paused[i] = 0;
+	clie_want_out(i, ce.out[i].count > 0);
+}
+
+/* codec negotiation, returns 1 when the rest of the inbound stream switches */
+int clie_hello(int i, const char *spec) {
+	char hello[CODEC_HELLO_MAX];
+	const void *d = NULL;
+	unsigned int dlen = 0;
+	stCodec_t *tx = NULL;
+	int offer, dict, fd;
+	const char *name = codec_hello_parse(spec, link_codec, &offer, &dict);
+
+	if (dict) {
+		d = codec_dict(&dlen);
+	}
+	if (offer) {
+		if (name != NULL && ce.out[i].codec == NULL) {
+			tx = codec_new(name, 1, d, dlen);
+			if (tx == NULL) {
+				log_err("client %d codec %s init failed, stay plain", ce.cli[i], name);
+				name = NULL;
+				dict = 0;
+			}
+		}
+		/* answer plain, everything we send after it is encoded */
+		codec_hello_answer(hello, sizeof(hello), name, dict);
+		if (frame_send(&ce.out[i], FRAME_HELLO, CHAN_CTRL, hello, strlen(hello) + 1) > 0) {
+			clie_want_out(i, 1);
+		}
+		if (tx != NULL) {
+			ce.out[i].codec = tx;
+		}
+		log_info("client %d codec: %s%s", ce.cli[i], name ? name : "none",
+						 dict ? " with dictionary" : "");
+		return 0;
+	}
+	/* the client echoed the answer, what follows it is encoded */
+	if (name == NULL || ce.rx[i] != NULL) {
+		return 0;
+	}
+	ce.rx[i] = codec_new(name, 0, d, dlen);
+	if (ce.rx[i] == NULL) {
+		/* the client already encodes, nothing after this can be parsed */
+		log_err("client %d codec %s init failed, drop it", ce.cli[i], name);
+		fd = ce.cli[i];
+		clie_del_cli(fd);
+		tcp_free(fd);
+	}
+	return 1;
+}
+
+int clie_frame(stEvent_t *e, void *arg) {
+	int i = (int *)arg - ce.cli;
+	int ret;
+
+	switch (e->type) {
+		case FRAME_DATA:
+		case FRAME_TOPIC:
+			stats_in(STATS_DOWN, e->chan, e->len);
+			if (cli_policy == RATE_SHAPE) {
+				tbucket_charge(&ce.tb[i], 1);
+			} else if (!tbucket_take(&ce.tb[i], 1)) {
+				ce.rl_dropped[i]++;
+				stats_drop(STATS_DOWN, e->chan);
+				break;
+			}
+			return pipe_push(&down_pipe, e);
+		case FRAME_PING:
+			if (frame_send_ctrl(&ce.out[i], FRAME_PONG) > 0) {
+				clie_want_out(i, 1);
+			}
+			break;
+		case FRAME_REQ:
+			rpc_request(i, e);
+			break;
+		case FRAME_HELLO:
+			ret = clie_hello(i, (const char *)e->data);
+			event_put(e);
+			return ret;
+		case FRAME_SUB:
+			if (filter_compile(&ce.filter[i], (const char *)e->data) == 0) {
+				log_info("client %d subscribed: %s", ce.cli[i], (char *)e->data);
+			}
+			break;
+		default:
+			break;
+	}
+	event_put(e);
+	return 0;
+}
+
+void clie_ping(stHeartbeat_t *hb) {
+	int i = (int *)hb->arg - ce.cli;
+	int ret = frame_send_ctrl(&ce.out[i], FRAME_PING);
+	if (ret < 0) {
+		log_debug("ping failed on %d", ce.cli[i]);
+	} else if (ret > 0) {
+		clie_want_out(i, 1);
+	}
+}
+
+void clie_dead(stHeartbeat_t *hb) {
+	int fd = *(int *)hb->arg;
+	log_warn("peer %d missed %d heartbeats, close it", fd, hb->missed);
+	clie_del_cli(fd);
+	tcp_free(fd);
+}
+
+void clie_event(void *arg, int fd, int events) {
+	int i;
+	for (i = 0; i < sizeof(ce.cli)/sizeof(ce.cli[0]); i++) {
+		if (ce.cli[i] == fd) {
+			break;
+		}
+	}
+	if (i >= sizeof(ce.cli)/sizeof(ce.cli[0])) {
+		return;
+	}
+	if (events & POLLERR) {
+		int ret = tcp_zc_complete(&ce.out[i].zc);
+		if (ret <= 0 && !(events & POLLIN)) {
+			log_debug("socket error, errqueue: close it");
+			clie_del_cli(fd);
+			tcp_free(fd);
+			return;
+		}
+	}
+	if (events & POLLOUT) {
+		int ret = tcp_out_flush(&ce.out[i]);
+		if (ret < 0) {
+			log_debug("socket error, send: close it");
+			clie_del_cli(fd);
+			tcp_free(fd);
+			return;
+		}
+		if (ret == 0) {
+			clie_want_out(i, 0);
+		}
+	}
+	/* a paused client is not read, nothing else would see it go */
+	if ((events & POLLHUP) && ce.paused[i]) {
+		log_debug("socket hangup while paused: close it");
+		clie_del_cli(fd);
+		tcp_free(fd);
+		return;
+	}
+	if (events & (POLLIN | POLLPRI | POLLHUP)) {
+		clie_in(arg, fd);
 	}
 }
 
@@ -405,12 +657,33 @@ int clie_add_cli(int fd) {
 		if (ifd > 0) {
 			continue;
 		}
+		tcp_out_init(&ce.out[i], fd);
+		if (seal_enabled() && seal_pair(&ce.out[i].seal, &ce.rx_seal[i], SEAL_S2C) < 0) {
+			log_err("link seal init failed, drop %d", fd);
+			tcp_out_free(&ce.out[i]);
+			tcp_free(fd);
+			return -1;
+		}
 		ce.cli[i] = fd;
+		filter_init(&ce.filter[i]);
+		queue_buf_init(&ce.qb[i], 0, CLIE_RECV_SIZE);
+		queue_buf_set_pool(&ce.qb[i], &ce.rx_pool);
+		heartbeat_init(&ce.hb[i], ce.th, hb_interval, hb_limit,
+									 clie_ping, clie_dead, &ce.cli[i]);
+		heartbeat_start(&ce.hb[i]);
+		tbucket_init(&ce.tb[i], cli_rate, cli_burst);
+		timer_init(&ce.rl_timer[i], clie_resume);
+		ce.paused[i] = 0;
+		ce.rl_dropped[i] = 0;
+		ce.rl_paused[i] = 0;
 		log_debug("add watch for :%d", fd);
-		file_event_reg(ce.fet, fd, clie_in, NULL, NULL);
-		break;
+		/* a sealed link opens with our salt */
+		clie_want_out(i, ce.out[i].seal != NULL);
+		return 0;
 	}
-	return 0;
+	log_warn("too many clients, drop %d", fd);
+	tcp_free(fd);
+	return -1;
 }
 int clie_del_cli(int fd) {
 	int i;
@@ -421,9 +694,257 @@ int clie_del_cli(int fd) {
 		}
 		if (ifd  == fd) {
 			ce.cli[i] = 0;
+			heartbeat_stop(&ce.hb[i]);
+			timer_cancel(ce.th, &ce.rl_timer[i]);
+			tcp_out_free(&ce.out[i]);
+			filter_free(&ce.filter[i]);
+			codec_free(ce.rx[i]);
+			ce.rx[i] = NULL;
+			seal_free(ce.rx_seal[i]);
+			ce.rx_seal[i] = NULL;
+			rpc_detach(i);
+			queue_buf_destroy(&ce.qb[i]);
 			file_event_unreg(ce.fet, fd, clie_in, NULL, NULL);
 		}
 	}
 	return 0;
 }
 
+/* module rpc */
+#define RPC_TIMEOUT_MS	5000
+#define RPC_INFLIGHT		64
+
+/* one ubus_invoke_async in flight on behalf of a client */
+typedef struct stRpcReq {
+	struct ubus_request req;
+	struct async_op op;
+	struct stRpcReq *next;
+	u32 id;
+	int cli;		/* -1 once the client went away */
+	int completed;
+	char *reply;
+}stRpcReq_t;
+
+typedef struct stRpcEnv {
+	struct timer_head *th;
+	struct hashmap objs;	/* path -> ubus object id */
+	struct blob_buf b;
+	stRpcReq_t *pending;
+	int inflight;
+}stRpcEnv_t;
+
+stRpcEnv_t re;
+
+HASHMAP_FUNCS_CREATE(rpc_obj, const char, u32)
+
+int rpc_init(void *_th) {
+	re.th = _th;
+	re.pending = NULL;
+	re.inflight = 0;
+	hashmap_init(&re.objs, hashmap_hash_string, hashmap_compare_string, 0);
+	hashmap_set_key_alloc_funcs(&re.objs, hashmap_alloc_key_string, free);
+	return 0;
+}
+
+/* ubus_lookup_id is a blocking round trip to ubusd, remember the ids */
+int rpc_lookup(const char *path, u32 *id) {
+	u32 *p = hashmap_rpc_obj_get(&re.objs, path);
+	if (p != NULL) {
+		*id = *p;
+		return 0;
+	}
+	int ret = ubus_lookup_id(ue.ubus_ctx, path, id);
+	if (ret != 0) {
+		return ret;
+	}
+	p = (u32 *)MALLOC(sizeof(*p));
+	if (p != NULL) {
+		*p = *id;
+		if (hashmap_rpc_obj_put(&re.objs, path, p) != p) {
+			FREE(p);
+		}
+	}
+	return 0;
+}
+
+void rpc_forget(const char *path) {
+	FREE(hashmap_rpc_obj_remove(&re.objs, path));
+}
+
+int rpc_reply(int cli, u32 id, int status, const char *reply) {
+	int len;
+	stEvent_t *e;
+	stFrameRpc_t hdr;
+
+	if (cli < 0 || ce.cli[cli] <= 0) {
+		return -1;
+	}
+	if (reply == NULL) {
+		reply = "";
+	}
+	len = sizeof(hdr) + strlen(reply) + 1;
+	e = event_packet(FRAME_RESP, len, NULL);
+	hdr.id = htonl(id);
+	hdr.status = htonl(status);
+	memcpy(e->data, &hdr, sizeof(hdr));
+	strcpy((char *)e->data + sizeof(hdr), reply);
+
+	void *frame = frame_encode(e, FRAME_RESP);
+	int ret = tcp_out_send(&ce.out[cli], frame, len + FRAME_HDR_LEN, event_release, e);
+	if (ret > 0) {
+		clie_want_out(cli, 1);
+	}
+	return ret;
+}
+
+static void rpc_data(struct ubus_request *req, int type, struct blob_attr *msg) {
+	stRpcReq_t *r = (stRpcReq_t *)req->priv;
+	free(r->reply);
+	r->reply = blobmsg_format_json(msg, true);
+}
+
+static void rpc_complete(struct ubus_request *req, int ret) {
+	stRpcReq_t *r = (stRpcReq_t *)req->priv;
+	r->completed = 1;
+	async_op_finish(&r->op, ret);
+}
+
+/* completion or timeout, whichever comes first */
+static void rpc_done(int status, void *arg) {
+	stRpcReq_t *r = (stRpcReq_t *)arg;
+	stRpcReq_t **pp;
+
+	if (!r->completed) {
+		ubus_abort_request(ue.ubus_ctx, &r->req);
+	}
+	log_debug("rpc %u done: %d", r->id, status);
+	rpc_reply(r->cli, r->id, status, r->reply);
+
+	for (pp = &re.pending; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == r) {
+			*pp = r->next;
+			break;
+		}
+	}
+	re.inflight--;
+	/* blobmsg_format_json output, not ours */
+	free(r->reply);
+	FREE(r);
+}
+
+int rpc_request(int cli, stEvent_t *e) {
+	const char *p = (const char *)e->data;
+	const char *end = p + e->len;
+	const char *path;
+	const char *method;
+	const char *args;
+	stFrameRpc_t hdr;
+	stRpcReq_t *r;
+	u32 obj;
+	int ret;
+
+	memcpy(&hdr.id, p, sizeof(hdr.id));
+	hdr.id = ntohl(hdr.id);
+	path = p + sizeof(hdr.id);
+	method = path + strlen(path) + 1;
+	if (method >= end) {
+		return rpc_reply(cli, hdr.id, UBUS_STATUS_INVALID_ARGUMENT, NULL);
+	}
+	args = method + strlen(method) + 1;
+	if (args >= end) {
+		args = "";
+	}
+	if (re.inflight >= RPC_INFLIGHT) {
+		return rpc_reply(cli, hdr.id, UBUS_STATUS_UNKNOWN_ERROR, NULL);
+	}
+
+	blob_buf_init(&re.b, 0);
+	if (args[0] != 0 && !blobmsg_add_json_from_string(&re.b, args)) {
+		return rpc_reply(cli, hdr.id, UBUS_STATUS_INVALID_ARGUMENT, NULL);
+	}
+	ret = rpc_lookup(path, &obj);
+	if (ret != 0) {
+		return rpc_reply(cli, hdr.id, ret, NULL);
+	}
+
+	r = (stRpcReq_t *)MALLOC(sizeof(*r));
+	if (r == NULL) {
+		return rpc_reply(cli, hdr.id, UBUS_STATUS_UNKNOWN_ERROR, NULL);
+	}
+	memset(r, 0, sizeof(*r));
+	ret = ubus_invoke_async(ue.ubus_ctx, obj, method, re.b.head, &r->req);
+	if (ret != 0) {
+		FREE(r);
+		if (ret == UBUS_STATUS_NOT_FOUND) {
+			rpc_forget(path);	//the object went away or was re-registered
+		}
+		return rpc_reply(cli, hdr.id, ret, NULL);
+	}
+	r->id = hdr.id;
+	r->cli = cli;
+	r->req.priv = r;
+	r->req.data_cb = rpc_data;
+	r->req.complete_cb = rpc_complete;
+	r->next = re.pending;
+	re.pending = r;
+	re.inflight++;
+
+	async_op_init(&r->op, re.th);
+	async_op_set_timeout_result(&r->op, UBUS_STATUS_TIMEOUT);
+	async_op_start(&r->op, rpc_done, r, RPC_TIMEOUT_MS);
+	ubus_complete_request_async(ue.ubus_ctx, &r->req);
+	log_debug("rpc %u: %s.%s", r->id, path, method);
+	return 0;
+}
+
+/* the client is gone, its answers are dropped when they arrive */
+void rpc_detach(int cli) {
+	stRpcReq_t *r;
+	for (r = re.pending; r != NULL; r = r->next) {
+		if (r->cli == cli) {
+			r->cli = -1;
+		}
+	}
+}
+
+/* ubus2net object, the link side of the read-only view */
+static void ubus_queues_dump(struct blob_buf *b) {
+	blobmsg_add_u32(b, "rpc_inflight", re.inflight);
+}
+
+static void ubus_clients_dump(struct blob_buf *b) {
+	void *tbl;
+	int i;
+	for (i = 0; i < sizeof(ce.cli)/sizeof(ce.cli[0]); i++) {
+		if (ce.cli[i] <= 0) {
+			continue;
+		}
+		tbl = blobmsg_open_table(b, NULL);
+		blobmsg_add_u32(b, "fd", ce.cli[i]);
+		blobmsg_add_u32(b, "backlog_bytes", ce.out[i].bytes);
+		blobmsg_add_u32(b, "backlog_frames", ce.out[i].count);
+		blobmsg_add_u32(b, "zerocopy_pending", ce.out[i].zc.pending);
+		blobmsg_add_u32(b, "missed_beats", ce.hb[i].missed);
+		stats_dump_rx(b, &ce.qb[i], &ce.rx_pool);
+		stats_dump_codec(b, ce.out[i].codec, ce.rx[i], ce.rx_seal[i]);
+		blobmsg_add_u8(b, "filtered", ce.filter[i].active);
+		blobmsg_add_u32(b, "passed", ce.filter[i].passed);
+		blobmsg_add_u32(b, "filtered_out", ce.filter[i].dropped);
+		blobmsg_add_u8(b, "paused", ce.paused[i]);
+		blobmsg_add_u32(b, "rate_paused", ce.rl_paused[i]);
+		blobmsg_add_u32(b, "rate_dropped", ce.rl_dropped[i]);
+		blobmsg_close_table(b, tbl);
+	}
+}
+
+static const stStatsDump_t ubus_dump = {
+	.up = &up_pipe,
+	.down = &down_pipe,
+	.link = &ce.eq,
+	.queues = ubus_queues_dump,
+	.clients = ubus_clients_dump,
+};
+
+int ubus_dump_init(void) {
+	return stats_dump_init(ue.ubus_ctx, &ubus_dump);
+}
@@ -19,6 +19,7 @@ TARGET_CFLAGS 		+= -Wall -g -O2 -I$(ROOTDIR)/inc -I$(ROOTDIR)/inc/ayla -I$(ROOTD
 TARGET_CXXFLAGS 	+= $(TARGET_CFLAGS) -std=c++0x
 
 TARGET_LDFLAGS 		+= -L$(ROOTDIR)/lib -lm -lrt -ldl -lpthread
-TARGET_LDFLAGS 	+= -L/usr/lib/ -ljansson -lubus -lblobmsg_json -lubox
+UBUS_LIBS		?= -lubus
+TARGET_LDFLAGS 	+= -L/usr/lib/ -ljansson $(UBUS_LIBS) -lblobmsg_json -lubox -lz -lcrypto
 #TARGET_LDFLAGS		+= -lstdc++
 
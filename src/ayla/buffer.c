@@ -8,7 +8,10 @@
  */
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 #include <ayla/utypes.h>
 #include <ayla/log.h>
@@ -96,15 +99,6 @@
 	} while (0)
 
 
-/*
- * Initialize a generic data buffer.
- */
-static void buf_data_init(struct buf_data *dp, size_t size)
-{
-	dp->size = size;
-	dp->len = 0;
-}
-
 /*
  * Structure representing an offset in a queue buffer.
  */
@@ -114,36 +108,147 @@ struct queue_buf_pos {
 };
 
 
-static struct queue_buf_data *queue_buf_data_realloc(struct queue_buf_data *dp,
+static struct queue_buf_seg *queue_buf_seg_alloc(struct queue_buf *qbuf,
 	size_t size)
 {
-	struct queue_buf_data *new_dp;
+	struct queue_buf_pool *pool = qbuf->pool;
+	struct queue_buf_seg *seg;
 
 	ASSERT(size > 0);
 
-	if (dp && dp->data.size == size) {
-		return dp;
+	if (pool && size <= pool->seg_size) {
+		seg = pool->free_seg;
+		if (seg) {
+			pool->free_seg = seg->next;
+			pool->nfree--;
+			qbuf->stats.pool_hits++;
+		} else {
+			seg = (struct queue_buf_seg *)malloc(sizeof(*seg) +
+			    pool->seg_size);
+			if (!seg) {
+				log_err("allocation failed");
+				return NULL;
+			}
+		}
+		seg->pool = pool;
+		seg->size = pool->seg_size;
+		if (++pool->in_use > pool->high) {
+			pool->high = pool->in_use;
+		}
+	} else {
+		seg = (struct queue_buf_seg *)malloc(sizeof(*seg) + size);
+		if (!seg) {
+			log_err("allocation failed");
+			return NULL;
+		}
+		seg->pool = NULL;
+		seg->size = size;
 	}
-	new_dp = (struct queue_buf_data *)realloc(dp,
-	    sizeof(struct queue_buf_data) + size);
-	if (!new_dp) {
-		log_err("allocation failed");
-		return dp;
+	seg->next = NULL;
+	seg->refcnt = 1;
+	qbuf->stats.allocs++;
+	return seg;
+}
+
+static void queue_buf_seg_put(struct queue_buf_seg *seg)
+{
+	struct queue_buf_pool *pool = seg->pool;
+
+	ASSERT(seg->refcnt > 0);
+
+	if (--seg->refcnt) {
+		return;
 	}
-	if (dp) {
-		new_dp->data.size = size;
-		if (new_dp->data.len > size) {
-			new_dp->data.len = size;
-		}
+	if (!pool) {
+		free(seg);
+		return;
+	}
+	pool->in_use--;
+	if (pool->nfree >= pool->max_free) {
+		free(seg);
+		return;
+	}
+	seg->next = pool->free_seg;
+	pool->free_seg = seg;
+	pool->nfree++;
+}
+
+/*
+ * Returns a new element covering all of seg.  Elements are kept by the
+ * pool of their segment.
+ */
+static struct queue_buf_data *queue_buf_dp_alloc(struct queue_buf_seg *seg)
+{
+	struct queue_buf_pool *pool = seg->pool;
+	struct queue_buf_data *dp;
+
+	if (pool && pool->free_dp) {
+		dp = pool->free_dp;
+		pool->free_dp = QBUF_NEXT(dp);
+		pool->nfree_dp--;
 	} else {
-		buf_data_init(&new_dp->data, size);
+		dp = (struct queue_buf_data *)malloc(sizeof(*dp));
+		if (!dp) {
+			log_err("allocation failed");
+			return NULL;
+		}
 	}
-	return new_dp;
+	QBUF_NEXT(dp) = NULL;
+	dp->seg = seg;
+	dp->data.buf = seg->buf;
+	dp->data.size = seg->size;
+	dp->data.len = 0;
+	return dp;
 }
 
-static inline struct queue_buf_data *queue_buf_data_alloc(size_t size)
+static struct queue_buf_data *queue_buf_data_alloc(struct queue_buf *qbuf,
+	size_t size)
+{
+	struct queue_buf_seg *seg;
+	struct queue_buf_data *dp;
+
+	seg = queue_buf_seg_alloc(qbuf, size);
+	if (!seg) {
+		return NULL;
+	}
+	dp = queue_buf_dp_alloc(seg);
+	if (!dp) {
+		queue_buf_seg_put(seg);
+	}
+	return dp;
+}
+
+/*
+ * Segments with other references are read-only.
+ */
+static inline bool queue_buf_data_writable(const struct queue_buf_data *dp)
+{
+	return dp->seg->refcnt == 1;
+}
+
+void queue_buf_data_free(struct queue_buf_data *dp)
+{
+	struct queue_buf_pool *pool;
+
+	if (!dp) {
+		return;
+	}
+	pool = dp->seg->pool;
+	queue_buf_seg_put(dp->seg);
+	if (pool && pool->nfree_dp < pool->max_free) {
+		QBUF_NEXT(dp) = pool->free_dp;
+		pool->free_dp = dp;
+		pool->nfree_dp++;
+		return;
+	}
+	free(dp);
+}
+
+static void queue_buf_data_drop(struct queue_buf *qbuf,
+	struct queue_buf_data *dp)
 {
-	return queue_buf_data_realloc(NULL, size);
+	qbuf->stats.released++;
+	queue_buf_data_free(dp);
 }
 
 static void queue_buf_data_free_tail(struct queue_buf *qbuf,
@@ -160,7 +265,7 @@ static void queue_buf_data_free_tail(struct queue_buf *qbuf,
 	}
 	while (dp) {
 		dp2 = QBUF_NEXT(dp);
-		free(dp);
+		queue_buf_data_drop(qbuf, dp);
 		dp = dp2;
 	}
 }
@@ -190,11 +295,57 @@ int queue_buf_init(struct queue_buf *qbuf, unsigned opts, size_t min_buf_size)
 	qbuf->max_len = 0;
 	qbuf->min_buf_size = min_buf_size;
 	qbuf->opt_mask = opts;
+	qbuf->pool = NULL;
+	memset(&qbuf->stats, 0, sizeof(qbuf->stats));
 	QBUF_INIT(qbuf);
 	queue_buf_reset(qbuf);
 	return 0;
 }
 
+void queue_buf_set_pool(struct queue_buf *qbuf, struct queue_buf_pool *pool)
+{
+	ASSERT(qbuf != NULL);
+
+	qbuf->pool = pool;
+}
+
+const struct queue_buf_stats *queue_buf_stats(const struct queue_buf *qbuf)
+{
+	ASSERT(qbuf != NULL);
+
+	return &qbuf->stats;
+}
+
+void queue_buf_pool_init(struct queue_buf_pool *pool, size_t seg_size,
+	unsigned max_free)
+{
+	ASSERT(pool != NULL);
+	ASSERT(seg_size > 0);
+
+	memset(pool, 0, sizeof(*pool));
+	pool->seg_size = seg_size;
+	pool->max_free = max_free;
+}
+
+void queue_buf_pool_destroy(struct queue_buf_pool *pool)
+{
+	struct queue_buf_seg *seg;
+	struct queue_buf_data *dp;
+
+	ASSERT(pool != NULL);
+
+	while ((seg = pool->free_seg) != NULL) {
+		pool->free_seg = seg->next;
+		free(seg);
+	}
+	while ((dp = pool->free_dp) != NULL) {
+		pool->free_dp = QBUF_NEXT(dp);
+		free(dp);
+	}
+	pool->nfree = 0;
+	pool->nfree_dp = 0;
+}
+
 void queue_buf_destroy(struct queue_buf *qbuf)
 {
 	ASSERT(qbuf != NULL);
@@ -228,20 +379,27 @@ void queue_buf_reset(struct queue_buf *qbuf)
 
 	qbuf->len = 0;
 
-	/* Retain first buffer if pre-alloc set */
+	/* Retain first buffer if pre-alloc set and it is ours alone */
 	if (qbuf->opt_mask & QBUF_OPT_PRE_ALLOC) {
 		dp = QBUF_HEAD(qbuf);
-		if (!dp || dp->data.size != qbuf->min_buf_size) {
+		if (!dp || !queue_buf_data_writable(dp) ||
+		    dp->seg->size < qbuf->min_buf_size ||
+		    (!dp->seg->pool && dp->seg->size != qbuf->min_buf_size)) {
 			/* Reset to min buf size if changed */
-			QBUF_REMOVE_HEAD(qbuf);
-			dp = queue_buf_data_realloc(dp, qbuf->min_buf_size);
-			if (!dp) {
-				/* Failed to allocate first buffer */
-				return;
+			if (dp) {
+				QBUF_REMOVE_HEAD(qbuf);
+				queue_buf_data_drop(qbuf, dp);
 			}
-			QBUF_INSERT_HEAD(qbuf, dp);
+			dp = queue_buf_data_alloc(qbuf, qbuf->min_buf_size);
+			if (dp) {
+				QBUF_INSERT_HEAD(qbuf, dp);
+			}
+		}
+		if (dp) {
+			dp->data.buf = dp->seg->buf;
+			dp->data.size = dp->seg->size;
+			dp->data.len = 0;
 		}
-		dp->data.len = 0;
 	}
 	/* Free any remaining buffers */
 	queue_buf_data_free_tail(qbuf, dp);
@@ -279,7 +437,7 @@ void queue_buf_trim(struct queue_buf *qbuf, size_t new_len)
 
 void queue_buf_trim_head(struct queue_buf *qbuf, size_t new_len)
 {
-	struct queue_buf_data *dp, *dp2, *pre_alloc_dp = NULL;
+	struct queue_buf_data *dp;
 	size_t len = 0;
 
 	ASSERT(qbuf != NULL);
@@ -294,52 +452,21 @@ void queue_buf_trim_head(struct queue_buf *qbuf, size_t new_len)
 	len = qbuf->len - new_len;	/* len is how many bytes to trim */
 	qbuf->len = new_len;
 
-	/* Remove or clear any full buffers to be trimmed */
+	/* Remove any full buffers to be trimmed */
 	dp = QBUF_HEAD(qbuf);
-	if ((qbuf->opt_mask & QBUF_OPT_PRE_ALLOC) && dp->data.len <= len) {
-		len -= dp->data.len;
-		dp->data.len = 0;
-		pre_alloc_dp = dp;
-		dp = QBUF_NEXT(dp);
-	}
 	while (dp && dp->data.len <= len) {
 		len -= dp->data.len;
-		if (pre_alloc_dp) {
-			QBUF_REMOVE_NEXT(qbuf, pre_alloc_dp);
-			dp2 = QBUF_NEXT(pre_alloc_dp);
-		} else {
-			QBUF_REMOVE_HEAD(qbuf);
-			dp2 = QBUF_HEAD(qbuf);
-		}
-		free(dp);
-		dp = dp2;
+		QBUF_REMOVE_HEAD(qbuf);
+		queue_buf_data_drop(qbuf, dp);
+		dp = QBUF_HEAD(qbuf);
 	}
-	if (!len && !pre_alloc_dp) {
+	if (!len) {
 		return;
 	}
-	/* Align partial buffers */
-	dp = QBUF_HEAD(qbuf);
-	/* Special case to handle an empty fixed first buffer */
-	if (!dp->data.len) {
-		dp2 =  QBUF_NEXT(dp);
-		ASSERT(dp2 != NULL);	/* Should only be here if next exists */
-		/* Copy data from second buffer to fixed first buffer */
-		dp->data.len = dp2->data.len - len;
-		if (dp->data.len > dp->data.size) {
-			dp->data.len = dp->data.size;
-		}
-		len += dp->data.len;
-		memcpy(dp->data.buf, dp2->data.buf, dp->data.len);
-		if (len == dp2->data.len) {
-			/* Moved all data from next node to first node */
-			QBUF_REMOVE_NEXT(qbuf, dp);
-			free(dp2);
-			return;
-		}
-		dp = dp2;
-	}
-	/* Standard case to shift remaining data to front of buffer */
-	memmove(dp->data.buf, dp->data.buf + len, dp->data.len - len);
+	ASSERT(dp != NULL);	/* Fails if qbuf->len is incorrect */
+	/* Move the partial buffer's window past the trimmed data */
+	dp->data.buf += len;
+	dp->data.size -= len;
 	dp->data.len -= len;
 }
 
@@ -373,14 +500,13 @@ void *queue_buf_coalesce(struct queue_buf *qbuf)
 	if (first->data.len == qbuf->len) {
 		return first->data.buf;
 	}
-	/* Expand first buffer to fit all data */
-	if (qbuf->len > first->data.size) {
-		QBUF_REMOVE_HEAD(qbuf);
-		first = queue_buf_data_realloc(first, qbuf->len);
-		QBUF_INSERT_HEAD(qbuf, first);
-		if (first->data.size != qbuf->len) {
+	/* Use a new first buffer if the current one can't take all data */
+	if (!queue_buf_data_writable(first) || qbuf->len > first->data.size) {
+		first = queue_buf_data_alloc(qbuf, qbuf->len);
+		if (!first) {
 			return NULL;
 		}
+		QBUF_INSERT_HEAD(qbuf, first);
 	}
 	/* Copy all data into first buffer and delete trailing buffers */
 	for (dp = QBUF_NEXT(first); dp; dp = QBUF_NEXT(first)) {
@@ -389,7 +515,7 @@ void *queue_buf_coalesce(struct queue_buf *qbuf)
 		    dp->data.len);
 		first->data.len += dp->data.len;
 		QBUF_REMOVE_NEXT(qbuf, first);
-		free(dp);
+		queue_buf_data_drop(qbuf, dp);
 	}
 	return first->data.buf;
 }
@@ -413,8 +539,8 @@ int queue_buf_put(struct queue_buf *qbuf, const void *data, size_t len)
 	if (!dp) {
 		goto fill_new;
 	}
-	/* Fill trailing buffer, if it is not full */
-	tlen = dp->data.size - dp->data.len;
+	/* Fill trailing buffer, if it is not full or shared */
+	tlen = queue_buf_data_writable(dp) ? dp->data.size - dp->data.len : 0;
 	if (!tlen) {
 		goto fill_new;
 	}
@@ -431,7 +557,7 @@ int queue_buf_put(struct queue_buf *qbuf, const void *data, size_t len)
 	}
 fill_new:
 	/* Add a new buffer to the tail */
-	dp = queue_buf_data_alloc(len < qbuf->min_buf_size ?
+	dp = queue_buf_data_alloc(qbuf, len < qbuf->min_buf_size ?
 	    qbuf->min_buf_size : len);
 	if (!dp) {
 		log_err("allocation failed");
@@ -468,7 +594,18 @@ int queue_buf_put_head(struct queue_buf *qbuf, const void *data, size_t len)
 	ASSERT(qbuf != NULL);
 	ASSERT(data != NULL);
 
-	dp = queue_buf_data_alloc(len < qbuf->min_buf_size ?
+	/* Reuse space left in front by queue_buf_trim_head() */
+	dp = QBUF_HEAD(qbuf);
+	if (dp && queue_buf_data_writable(dp) &&
+	    (size_t)(dp->data.buf - dp->seg->buf) >= len) {
+		dp->data.buf -= len;
+		dp->data.size += len;
+		dp->data.len += len;
+		memcpy(dp->data.buf, data, len);
+		qbuf->len += len;
+		return 0;
+	}
+	dp = queue_buf_data_alloc(qbuf, len < qbuf->min_buf_size ?
 	    qbuf->min_buf_size : len);
 	if (!dp) {
 		log_err("allocation failed");
@@ -481,6 +618,212 @@ int queue_buf_put_head(struct queue_buf *qbuf, const void *data, size_t len)
 	return 0;
 }
 
+ssize_t queue_buf_readv(int fd, struct queue_buf *qbuf, size_t len)
+{
+	struct queue_buf_data *dp, *new_dp[QBUF_IOV_MAX];
+	struct iovec iov[QBUF_IOV_MAX];
+	int iovcnt = 0, nnew = 0, i;
+	size_t seg_size, size, want;
+	size_t tlen = 0;
+	ssize_t rc;
+
+	ASSERT(qbuf != NULL);
+
+	if (!len) {
+		return 0;
+	}
+	if (qbuf->max_len) {
+		if (qbuf->len >= qbuf->max_len) {
+			log_err("exceeds max size: %zu bytes", qbuf->max_len);
+			errno = ENOBUFS;
+			return -1;
+		}
+		if (len > qbuf->max_len - qbuf->len) {
+			len = qbuf->max_len - qbuf->len;
+		}
+	}
+	/* Read into trailing buffer space first */
+	dp = QBUF_TAIL(qbuf);
+	if (dp && queue_buf_data_writable(dp) && dp->data.size > dp->data.len) {
+		tlen = dp->data.size - dp->data.len;
+		if (tlen > len) {
+			tlen = len;
+		}
+		iov[iovcnt].iov_base = dp->data.buf + dp->data.len;
+		iov[iovcnt].iov_len = tlen;
+		iovcnt++;
+	}
+	/*
+	 * Then into new buffers, pool sized if the queue has a pool, linked
+	 * only if they receive data.
+	 */
+	seg_size = qbuf->pool ? qbuf->pool->seg_size : 0;
+	for (want = len - tlen; want && iovcnt < QBUF_IOV_MAX; want -= size) {
+		size = want;
+		if (seg_size && size > seg_size && iovcnt < QBUF_IOV_MAX - 1) {
+			size = seg_size;
+		}
+		new_dp[nnew] = queue_buf_data_alloc(qbuf,
+		    size < qbuf->min_buf_size ? qbuf->min_buf_size : size);
+		if (!new_dp[nnew]) {
+			break;
+		}
+		iov[iovcnt].iov_base = new_dp[nnew]->data.buf;
+		iov[iovcnt].iov_len = size;
+		iovcnt++;
+		nnew++;
+	}
+	if (!iovcnt) {
+		errno = ENOMEM;
+		return -1;
+	}
+	do {
+		rc = readv(fd, iov, iovcnt);
+	} while (rc < 0 && errno == EINTR);
+	if (rc <= 0) {
+		for (i = 0; i < nnew; i++) {
+			queue_buf_data_drop(qbuf, new_dp[i]);
+		}
+		return rc;
+	}
+	qbuf->len += rc;
+	len = rc;
+	if (tlen) {
+		if (tlen > len) {
+			tlen = len;
+		}
+		dp->data.len += tlen;
+		len -= tlen;
+	}
+	for (i = 0; i < nnew; i++) {
+		if (!len) {
+			queue_buf_data_drop(qbuf, new_dp[i]);
+			continue;
+		}
+		size = iov[iovcnt - nnew + i].iov_len;
+		new_dp[i]->data.len = size < len ? size : len;
+		len -= new_dp[i]->data.len;
+		QBUF_INSERT_TAIL(qbuf, new_dp[i]);
+	}
+	return rc;
+}
+
+ssize_t queue_buf_recv(struct queue_buf *qbuf, int fd, size_t len)
+{
+	return queue_buf_readv(fd, qbuf, len);
+}
+
+int queue_buf_to_iovec(const struct queue_buf *qbuf, struct iovec *iov,
+	int max, size_t offset)
+{
+	struct queue_buf_pos pos;
+	int n = 0;
+
+	ASSERT(qbuf != NULL);
+	ASSERT(iov != NULL || !max);
+
+	if (queue_buf_get_pos(qbuf, offset, &pos) < 0) {
+		return 0;
+	}
+	for (; pos.dp && n < max; pos.dp = QBUF_NEXT(pos.dp), pos.offset = 0) {
+		if (pos.offset >= pos.dp->data.len) {
+			continue;
+		}
+		iov[n].iov_base = pos.dp->data.buf + pos.offset;
+		iov[n].iov_len = pos.dp->data.len - pos.offset;
+		n++;
+	}
+	return n;
+}
+
+ssize_t queue_buf_writev(int fd, struct queue_buf *qbuf)
+{
+	struct iovec iov[QBUF_IOV_MAX];
+	int iovcnt;
+	ssize_t rc;
+
+	ASSERT(qbuf != NULL);
+
+	iovcnt = queue_buf_to_iovec(qbuf, iov, QBUF_IOV_MAX, 0);
+	if (!iovcnt) {
+		return 0;
+	}
+	do {
+		rc = writev(fd, iov, iovcnt);
+	} while (rc < 0 && errno == EINTR);
+	if (rc > 0) {
+		queue_buf_trim_head(qbuf, qbuf->len - rc);
+	}
+	return rc;
+}
+
+struct queue_buf_data *queue_buf_detach_head(struct queue_buf *qbuf)
+{
+	struct queue_buf_data *dp;
+
+	ASSERT(qbuf != NULL);
+
+	dp = QBUF_HEAD(qbuf);
+	if (!dp) {
+		return NULL;
+	}
+	QBUF_REMOVE_HEAD(qbuf);
+	QBUF_NEXT(dp) = NULL;
+	qbuf->len -= dp->data.len;
+	return dp;
+}
+
+int queue_buf_share(struct queue_buf *dst, const struct queue_buf *src,
+	size_t offset, size_t len)
+{
+	struct queue_buf_pos pos;
+	struct queue_buf_data *dp;
+	size_t orig_len;
+	size_t tlen;
+
+	ASSERT(dst != NULL);
+	ASSERT(src != NULL);
+	ASSERT(dst != src);
+
+	if (!len) {
+		return 0;
+	}
+	if (offset + len > src->len ||
+	    queue_buf_get_pos(src, offset, &pos) < 0) {
+		log_err("no data to share");
+		return -1;
+	}
+	if (dst->max_len && dst->max_len < dst->len + len) {
+		log_err("exceeds max size: %zu bytes", dst->max_len);
+		return -1;
+	}
+	orig_len = dst->len;
+	while (len) {
+		tlen = pos.dp->data.len - pos.offset;
+		if (tlen > len) {
+			tlen = len;
+		}
+		if (tlen) {
+			dp = queue_buf_dp_alloc(pos.dp->seg);
+			if (!dp) {
+				queue_buf_trim(dst, orig_len);
+				return -1;
+			}
+			pos.dp->seg->refcnt++;
+			dp->data.buf = pos.dp->data.buf + pos.offset;
+			dp->data.size = tlen;
+			dp->data.len = tlen;
+			QBUF_INSERT_TAIL(dst, dp);
+			dst->len += tlen;
+			dst->stats.shared++;
+			len -= tlen;
+		}
+		pos.dp = QBUF_NEXT(pos.dp);
+		pos.offset = 0;
+	}
+	return 0;
+}
+
 static size_t queue_buf_copyout_pos(struct queue_buf_pos *pos,
 	void *buf, size_t len)
 {
@@ -539,6 +882,95 @@ int queue_buf_walk(const struct queue_buf *qbuf,
 	return 0;
 }
 
+const void *queue_buf_peek(const struct queue_buf *qbuf, size_t offset,
+	size_t len)
+{
+	struct queue_buf_pos pos;
+
+	ASSERT(qbuf != NULL);
+
+	if (!len || offset + len > qbuf->len ||
+	    queue_buf_get_pos(qbuf, offset, &pos) < 0) {
+		return NULL;
+	}
+	/* offset may fall on the end of a buffer */
+	while (pos.dp && pos.offset == pos.dp->data.len) {
+		pos.dp = QBUF_NEXT(pos.dp);
+		pos.offset = 0;
+	}
+	if (!pos.dp || pos.dp->data.len - pos.offset < len) {
+		return NULL;
+	}
+	return pos.dp->data.buf + pos.offset;
+}
+
+int queue_buf_view_init(struct queue_buf_view *view,
+	const struct queue_buf *qbuf, size_t offset, size_t len)
+{
+	struct queue_buf_data *dp;
+
+	ASSERT(view != NULL);
+	ASSERT(qbuf != NULL);
+
+	queue_buf_init(&view->pin, 0, 0);
+	view->ptr = NULL;
+	view->len = 0;
+	if (queue_buf_share(&view->pin, qbuf, offset, len) < 0) {
+		return -1;
+	}
+	view->len = len;
+	/* Contiguous fast path */
+	dp = QBUF_HEAD(&view->pin);
+	if (dp && dp == QBUF_TAIL(&view->pin)) {
+		view->ptr = dp->data.buf;
+	}
+	return 0;
+}
+
+int queue_buf_view_slice(struct queue_buf_view *slice,
+	const struct queue_buf_view *view, size_t offset, size_t len)
+{
+	ASSERT(view != NULL);
+
+	return queue_buf_view_init(slice, &view->pin, offset, len);
+}
+
+void queue_buf_view_release(struct queue_buf_view *view)
+{
+	ASSERT(view != NULL);
+
+	queue_buf_destroy(&view->pin);
+	view->ptr = NULL;
+	view->len = 0;
+}
+
+size_t queue_buf_view_copyout(const struct queue_buf_view *view, void *buf,
+	size_t len, size_t offset)
+{
+	ASSERT(view != NULL);
+	ASSERT(buf != NULL);
+
+	if (view->ptr) {
+		if (offset >= view->len) {
+			return 0;
+		}
+		if (len > view->len - offset) {
+			len = view->len - offset;
+		}
+		memcpy(buf, view->ptr + offset, len);
+		return len;
+	}
+	return queue_buf_copyout(&view->pin, buf, len, offset);
+}
+
+int queue_buf_view_walk(const struct queue_buf_view *view,
+	int (*callback)(const void *, size_t, void *), void *arg)
+{
+	ASSERT(view != NULL);
+
+	return queue_buf_walk(&view->pin, callback, arg);
+}
+
 #ifdef SUPPORT_JSON
 static int queue_buf_json_write(const char *buf, size_t len, void *arg)
 {
@@ -581,6 +1013,7 @@ json_t *queue_buf_parse_json(const struct queue_buf *qbuf, size_t offset)
 {
 	struct queue_buf_pos pos;
 	json_error_t error;
+	const void *data;
 	json_t *root;
 
 	ASSERT(qbuf != NULL);
@@ -589,13 +1022,30 @@ json_t *queue_buf_parse_json(const struct queue_buf *qbuf, size_t offset)
 		log_err("no data to copy");
 		return NULL;
 	}
-	root = json_load_callback(queue_buf_json_read, &pos, 0, &error);
+	data = queue_buf_peek(qbuf, offset, qbuf->len - offset);
+	if (data) {
+		/* All data in one buffer, parse it in place */
+		root = json_loadb(data, qbuf->len - offset, 0, &error);
+	} else {
+		root = json_load_callback(queue_buf_json_read, &pos, 0, &error);
+	}
 	if (!root) {
 		log_err("JSON parse error at line %d: %s",
 		    error.line, error.text);
 	}
 	return root;
 }
+
+json_t *queue_buf_view_parse_json(const struct queue_buf_view *view)
+{
+	ASSERT(view != NULL);
+
+	if (!view->len) {
+		log_err("no data to copy");
+		return NULL;
+	}
+	return queue_buf_parse_json(&view->pin, 0);
+}
 #endif
 
 void queue_buf_dump(const struct queue_buf *qbuf, const char *name,
@@ -606,12 +1056,15 @@ void queue_buf_dump(const struct queue_buf *qbuf, const char *name,
 
 	ASSERT(qbuf != NULL);
 
-	log_debug("%s:\t max_len=%zu min_buf_size=%zu len=%zu opts=%04X",
+	log_debug("%s:\t max_len=%zu min_buf_size=%zu len=%zu opts=%04X "
+	    "allocs=%lu pool_hits=%lu shared=%lu",
 	    name ? name : "queue",
-	    qbuf->max_len, qbuf->min_buf_size, qbuf->len, qbuf->opt_mask);
+	    qbuf->max_len, qbuf->min_buf_size, qbuf->len, qbuf->opt_mask,
+	    qbuf->stats.allocs, qbuf->stats.pool_hits, qbuf->stats.shared);
 	QBUF_FOREACH(dp, qbuf) {
-		log_debug("data[%02u]\t size=%zu len=%zu",
-		    i++, dp->data.size, dp->data.len);
+		log_debug("data[%02u]\t size=%zu len=%zu refcnt=%u%s",
+		    i++, dp->data.size, dp->data.len, dp->seg->refcnt,
+		    dp->seg->pool ? " pooled" : "");
 		if (with_hex && dp->data.len) {
 			log_debug_hex("buf\t", dp->data.buf, dp->data.len);
 		}
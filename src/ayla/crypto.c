@@ -16,6 +16,9 @@
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
 #include <openssl/aes.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/kdf.h>
 
 #include <ayla/utypes.h>
 #include <ayla/log.h>
@@ -46,6 +49,18 @@ struct crypto_ctx_aes_openssl {
 	u8 iv[AES_BLOCK_SIZE];
 };
 
+/*
+ * Openssl AES GCM crypto context.  The EVP contexts are keyed once at
+ * init, each message only loads its nonce.
+ */
+struct crypto_ctx_aes_gcm_openssl {
+	EVP_CIPHER_CTX *encrypt_ctx;
+	EVP_CIPHER_CTX *decrypt_ctx;
+	u8 tx_nonce[CRYPTO_GCM_NONCE_LEN];
+	u8 rx_nonce[CRYPTO_GCM_NONCE_LEN];
+	bool rx_started;
+};
+
 /*
  * Load Openssl common resources and config once per process.
  */
@@ -165,6 +180,7 @@ static int crypto_init_rsa_openssl(struct crypto_state *state,
 	unsigned long err;
 	BIO *bio = NULL;
 	struct crypto_ctx_rsa_openssl *ctx;
+	const BIGNUM *n;
 	int rc = -1;
 
 	/* Load Openssl common modules */
@@ -215,7 +231,12 @@ static int crypto_init_rsa_openssl(struct crypto_state *state,
 		}
 		break;
 	}
-	if (!ctx->rsa->n) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	RSA_get0_key(ctx->rsa, &n, NULL, NULL);
+#else
+	n = ctx->rsa->n;
+#endif
+	if (!n) {
 		log_err("RSA key init failed");
 		goto error;
 	}
@@ -345,6 +366,187 @@ error:
 	return -1;
 }
 
+/*
+ * Advance a GCM nonce: the low 8 bytes are a big endian counter.
+ */
+static void crypto_aes_gcm_nonce_next(u8 *nonce)
+{
+	int i;
+
+	for (i = CRYPTO_GCM_NONCE_LEN - 1; i >= CRYPTO_GCM_NONCE_LEN - 8; i--) {
+		if (++nonce[i]) {
+			break;
+		}
+	}
+}
+
+/*
+ * Default AES GCM encrypt function.  Writes nonce, ciphertext and tag.
+ */
+static ssize_t crypto_encrypt_aes_gcm_openssl(void *context,
+	const void *in_buf, size_t in_size,
+	void *out_buf, size_t out_size)
+{
+	struct crypto_ctx_aes_gcm_openssl *ctx =
+	    (struct crypto_ctx_aes_gcm_openssl *)context;
+	u8 *out = (u8 *)out_buf;
+	size_t out_len;
+	int len;
+
+	out_len = in_size + CRYPTO_GCM_OVERHEAD;
+	if (!out_buf) {
+		return out_len;
+	}
+	if (out_len > out_size) {
+		log_err("out_buf must be at least %zu bytes", out_len);
+		return -1;
+	}
+	memcpy(out, ctx->tx_nonce, CRYPTO_GCM_NONCE_LEN);
+	out += CRYPTO_GCM_NONCE_LEN;
+	if (!EVP_EncryptInit_ex(ctx->encrypt_ctx, NULL, NULL, NULL,
+	    ctx->tx_nonce) ||
+	    !EVP_EncryptUpdate(ctx->encrypt_ctx, out, &len,
+	    (const unsigned char *)in_buf, (int)in_size) ||
+	    !EVP_EncryptFinal_ex(ctx->encrypt_ctx, out + len, &len) ||
+	    !EVP_CIPHER_CTX_ctrl(ctx->encrypt_ctx, EVP_CTRL_GCM_GET_TAG,
+	    CRYPTO_GCM_TAG_LEN, out + in_size)) {
+		CRYPTO_OPENSSL_LOG_ERR("encrypt failed", ERR_peek_last_error());
+		return -1;
+	}
+	crypto_aes_gcm_nonce_next(ctx->tx_nonce);
+	return out_len;
+}
+
+/*
+ * Default AES GCM decrypt function.  The first message sets the nonce
+ * sequence, every later one must carry the next nonce.
+ */
+static ssize_t crypto_decrypt_aes_gcm_openssl(void *context,
+	const void *in_buf, size_t in_size,
+	void *out_buf, size_t out_size)
+{
+	struct crypto_ctx_aes_gcm_openssl *ctx =
+	    (struct crypto_ctx_aes_gcm_openssl *)context;
+	const u8 *in = (const u8 *)in_buf;
+	size_t out_len;
+	int len;
+
+	if (in_size < CRYPTO_GCM_OVERHEAD) {
+		log_err("message too short: %zu bytes", in_size);
+		return -1;
+	}
+	out_len = in_size - CRYPTO_GCM_OVERHEAD;
+	if (!out_buf) {
+		return out_len;
+	}
+	if (out_len > out_size) {
+		log_err("out_buf must be at least %zu bytes", out_len);
+		return -1;
+	}
+	if (ctx->rx_started &&
+	    memcmp(in, ctx->rx_nonce, CRYPTO_GCM_NONCE_LEN)) {
+		log_err("unexpected nonce: replayed or reordered message");
+		return -1;
+	}
+	if (!EVP_DecryptInit_ex(ctx->decrypt_ctx, NULL, NULL, NULL, in) ||
+	    !EVP_DecryptUpdate(ctx->decrypt_ctx, (unsigned char *)out_buf,
+	    &len, in + CRYPTO_GCM_NONCE_LEN, (int)out_len) ||
+	    !EVP_CIPHER_CTX_ctrl(ctx->decrypt_ctx, EVP_CTRL_GCM_SET_TAG,
+	    CRYPTO_GCM_TAG_LEN,
+	    (void *)(in + CRYPTO_GCM_NONCE_LEN + out_len))) {
+		CRYPTO_OPENSSL_LOG_ERR("decrypt failed", ERR_peek_last_error());
+		return -1;
+	}
+	if (EVP_DecryptFinal_ex(ctx->decrypt_ctx,
+	    (unsigned char *)out_buf + len, &len) <= 0) {
+		log_err("decrypt failed: authentication tag mismatch");
+		return -1;
+	}
+	memcpy(ctx->rx_nonce, in, CRYPTO_GCM_NONCE_LEN);
+	crypto_aes_gcm_nonce_next(ctx->rx_nonce);
+	ctx->rx_started = true;
+	return out_len;
+}
+
+/*
+ * Default AES GCM cleanup function.
+ */
+static void crypto_cleanup_aes_gcm_openssl(void *context)
+{
+	struct crypto_ctx_aes_gcm_openssl *ctx =
+	    (struct crypto_ctx_aes_gcm_openssl *)context;
+
+	if (!ctx) {
+		return;
+	}
+	EVP_CIPHER_CTX_free(ctx->encrypt_ctx);
+	EVP_CIPHER_CTX_free(ctx->decrypt_ctx);
+	free(ctx);
+}
+
+/*
+ * Default AES GCM init function: Openssl EVP, which uses AES-NI/PCLMUL
+ * where the CPU has them.
+ */
+static int crypto_init_aes_gcm_openssl(struct crypto_state *state,
+	const u8 *key, size_t key_len)
+{
+	struct crypto_ctx_aes_gcm_openssl *ctx;
+	const EVP_CIPHER *cipher;
+
+	switch (key_len) {
+	case 16:
+		cipher = EVP_aes_128_gcm();
+		break;
+	case 24:
+		cipher = EVP_aes_192_gcm();
+		break;
+	case 32:
+		cipher = EVP_aes_256_gcm();
+		break;
+	default:
+		log_err("unsupported key length %zu", key_len);
+		return -1;
+	}
+
+	/* Load Openssl common modules */
+	crypto_init_openssl();
+
+	ctx = (struct crypto_ctx_aes_gcm_openssl *)calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		log_err("malloc failed");
+		goto error;
+	}
+	ctx->encrypt_ctx = EVP_CIPHER_CTX_new();
+	ctx->decrypt_ctx = EVP_CIPHER_CTX_new();
+	if (!ctx->encrypt_ctx || !ctx->decrypt_ctx) {
+		log_err("malloc failed");
+		goto error;
+	}
+	/* Default GCM IV length is the 12 byte nonce */
+	if (!EVP_EncryptInit_ex(ctx->encrypt_ctx, cipher, NULL, key, NULL)) {
+		log_err("encrypt key init failed");
+		goto error;
+	}
+	if (!EVP_DecryptInit_ex(ctx->decrypt_ctx, cipher, NULL, key, NULL)) {
+		log_err("decrypt key init failed");
+		goto error;
+	}
+	/* Random start, contexts sharing a key do not reuse nonces */
+	if (RAND_bytes(ctx->tx_nonce, sizeof(ctx->tx_nonce)) != 1) {
+		log_err("nonce init failed");
+		goto error;
+	}
+	state->encrypt = crypto_encrypt_aes_gcm_openssl;
+	state->decrypt = crypto_decrypt_aes_gcm_openssl;
+	state->context_free = crypto_cleanup_aes_gcm_openssl;
+	state->context = (void *)ctx;
+	return 0;
+error:
+	crypto_cleanup_aes_gcm_openssl(ctx);
+	return -1;
+}
+
 /*
  * Initialize the crypto_state for RSA encryption/decryption with the
  * specified PEM formatted key.
@@ -387,6 +589,25 @@ int crypto_init_aes(struct crypto_state *state,
 	return crypto_init_aes_openssl(state, iv, key, key_len);
 }
 
+/*
+ * Initialize the crypto_state for AES GCM authenticated encryption.
+ */
+int crypto_init_aes_gcm(struct crypto_state *state,
+	const u8 *key, size_t key_len)
+{
+	ASSERT(state != NULL);
+	ASSERT(key != NULL);
+
+	if (!platform_crypto_init_aes_gcm(state, key, key_len)) {
+		return 0;
+	}
+	/*
+	 * Default to Openssl if platform-specific version failed or
+	 * is not implemented.
+	 */
+	return crypto_init_aes_gcm_openssl(state, key, key_len);
+}
+
 /*
  * Encrypt the data in in_buf and write it to out_buf.
  * Returns the number of bytes written to out_buf, or -1 on error.
@@ -442,3 +663,52 @@ void crypto_cleanup(struct crypto_state *state)
 	state->context_free(state->context);
 	memset(state, 0, sizeof(*state));
 }
+
+/*
+ * Fill buf with len bytes from the random number generator.
+ */
+int crypto_random(void *buf, size_t len)
+{
+	ASSERT(buf != NULL);
+
+	if (RAND_bytes(buf, (int)len) != 1) {
+		CRYPTO_OPENSSL_LOG_ERR("random failed", ERR_peek_last_error());
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * HKDF with SHA-256, extract and expand in one call.
+ */
+int crypto_hkdf_sha256(void *out, size_t out_len,
+	const void *key, size_t key_len,
+	const void *salt, size_t salt_len,
+	const void *info, size_t info_len)
+{
+	EVP_PKEY_CTX *pctx;
+	size_t len = out_len;
+	int rc = -1;
+
+	ASSERT(out != NULL);
+	ASSERT(key != NULL);
+
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+	if (!pctx) {
+		log_err("malloc failed");
+		return -1;
+	}
+	if (EVP_PKEY_derive_init(pctx) <= 0 ||
+	    EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256()) <= 0 ||
+	    EVP_PKEY_CTX_set1_hkdf_salt(pctx, salt, (int)salt_len) <= 0 ||
+	    EVP_PKEY_CTX_set1_hkdf_key(pctx, key, (int)key_len) <= 0 ||
+	    EVP_PKEY_CTX_add1_hkdf_info(pctx, info, (int)info_len) <= 0 ||
+	    EVP_PKEY_derive(pctx, out, &len) <= 0 || len != out_len) {
+		CRYPTO_OPENSSL_LOG_ERR("hkdf failed", ERR_peek_last_error());
+		goto error;
+	}
+	rc = 0;
+error:
+	EVP_PKEY_CTX_free(pctx);
+	return rc;
+}
@@ -0,0 +1,125 @@
+#include "chanq.h"
+#include "common.h"
+
+void chanq_init(stChanQueue_t *cq, int quantum) {
+	static const int weights[EVENT_PRIO_MAX] = CHANQ_WEIGHTS;
+	stChanLevel_t *lv;
+	int i, p;
+	for (p = 0; p < EVENT_PRIO_MAX; p++) {
+		lv = &cq->lv[p];
+		for (i = 0; i < CHAN_MAX; i++) {
+			ilist_init(&lv->q[i]);
+			lv->deficit[i] = 0;
+		}
+		lv->cur = 0;
+		lv->credited = 0;
+		lv->size = 0;
+		lv->weight = weights[p];
+		lv->credit = weights[p];
+	}
+	for (i = 0; i < CHAN_MAX; i++) {
+		cq->depth[i] = 0;
+	}
+	cq->quantum = quantum;
+	cq->size = 0;
+}
+
+void chanq_weight(stChanQueue_t *cq, int prio, int weight) {
+	if (prio >= 0 && prio < EVENT_PRIO_MAX && weight >= 0) {
+		cq->lv[prio].weight = weight;
+		cq->lv[prio].credit = weight;
+	}
+}
+
+void chanq_push(stChanQueue_t *cq, stEvent_t *e) {
+	int chan = e->chan;
+	int prio = e->prio;
+	if (chan < 0 || chan >= CHAN_MAX) {
+		chan = CHAN_CTRL;
+	}
+	if (prio < 0 || prio >= EVENT_PRIO_MAX) {
+		prio = EVENT_PRIO_NORMAL;
+	}
+	ilist_push_back(&cq->lv[prio].q[chan], &e->node);
+	cq->lv[prio].size++;
+	cq->depth[chan]++;
+	cq->size++;
+}
+
+/* deficit round robin over the channels of one non empty level */
+static void chanq_level_pop(stChanQueue_t *cq, stChanLevel_t *lv, stEvent_t **e) {
+	stListNode_t *n;
+	stEvent_t *h;
+	int i;
+
+	for (;;) {
+		i = lv->cur;
+		n = ilist_peek_front(&lv->q[i]);
+		if (n == NULL) {
+			lv->deficit[i] = 0;
+			lv->credited = 0;
+			lv->cur = (i + 1) % CHAN_MAX;
+			continue;
+		}
+		h = ilist_entry(n, stEvent_t, node);
+		/* one quantum per visit, larger events wait for several rounds */
+		if (!lv->credited) {
+			lv->deficit[i] += cq->quantum;
+			lv->credited = 1;
+		}
+		if (lv->deficit[i] >= h->len) {
+			lv->deficit[i] -= h->len;
+			ilist_pop_front(&lv->q[i]);
+			*e = h;
+			lv->size--;
+			cq->depth[i]--;
+			cq->size--;
+			return;
+		}
+		lv->credited = 0;
+		lv->cur = (i + 1) % CHAN_MAX;
+	}
+}
+
+bool chanq_pop(stChanQueue_t *cq, stEvent_t **e) {
+	stChanLevel_t *lv;
+	int p;
+
+	if (cq->size <= 0) {
+		return false;
+	}
+	for (;;) {
+		for (p = 0; p < EVENT_PRIO_MAX; p++) {
+			lv = &cq->lv[p];
+			if (lv->size > 0 && (lv->weight == 0 || lv->credit > 0)) {
+				if (lv->weight > 0) {
+					lv->credit--;
+				}
+				chanq_level_pop(cq, lv, e);
+				return true;
+			}
+		}
+		/* every waiting level spent its share, start a new round */
+		for (p = 0; p < EVENT_PRIO_MAX; p++) {
+			cq->lv[p].credit = cq->lv[p].weight;
+		}
+	}
+}
+
+int chanq_size(stChanQueue_t *cq) {
+	return cq->size;
+}
+
+int chanq_depth(stChanQueue_t *cq, int chan) {
+	if (chan < 0 || chan >= CHAN_MAX) {
+		return 0;
+	}
+	return cq->depth[chan];
+}
+
+int chanq_level_size(stChanQueue_t *cq, int prio) {
+	if (prio < 0 || prio >= EVENT_PRIO_MAX) {
+		return 0;
+	}
+	return cq->lv[prio].size;
+}
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "common.h"
+#include "log.h"
+#include "buffer.h"
+#include "tcp.h"
+#include "jansson.h"
+#include "codec.h"
+#include "seal.h"
+
+#define CODEC_CHUNK		(16 * 1024)
+#define CODEC_DICT_MAX	(32 * 1024)	/* deflate window */
+
+static char dict_buf[CODEC_DICT_MAX];
+static unsigned int dict_len;
+static u32 dict_id;
+
+/* deflate, raw streams so the dictionary needs no negotiation in-band */
+static int zlib_init(stCodec_t *c, const void *dict, unsigned int dlen) {
+	z_stream *z = MALLOC(sizeof(*z));
+	int ret;
+
+	if (z == NULL) {
+		return -1;
+	}
+	memset(z, 0, sizeof(*z));
+	if (c->enc) {
+		ret = deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		if (ret == Z_OK && dlen > 0) {
+			ret = deflateSetDictionary(z, dict, dlen);
+		}
+	} else {
+		ret = inflateInit2(z, -15);
+		if (ret == Z_OK && dlen > 0) {
+			ret = inflateSetDictionary(z, dict, dlen);
+		}
+	}
+	if (ret != Z_OK) {
+		log_warn("zlib init: %d", ret);
+		FREE(z);
+		return -1;
+	}
+	c->priv = z;
+	return 0;
+}
+
+static int zlib_deflate(stCodec_t *c, int flush) {
+	z_stream *z = c->priv;
+	int ret;
+
+	do {
+		if (codec_reserve(c, CODEC_CHUNK) < 0) {
+			return -1;
+		}
+		z->next_out = (Bytef *)c->obuf + c->olen;
+		z->avail_out = c->osize - c->olen;
+		ret = deflate(z, flush);
+		if (ret == Z_STREAM_ERROR) {
+			return -1;
+		}
+		c->olen = c->osize - z->avail_out;
+	} while (z->avail_in > 0 || z->avail_out == 0);
+	return 0;
+}
+
+static int zlib_encode(stCodec_t *c, const void *in, unsigned int len) {
+	z_stream *z = c->priv;
+
+	z->next_in = (Bytef *)in;
+	z->avail_in = len;
+	return zlib_deflate(c, Z_NO_FLUSH);
+}
+
+static int zlib_flush(stCodec_t *c) {
+	z_stream *z = c->priv;
+
+	z->next_in = NULL;
+	z->avail_in = 0;
+	return zlib_deflate(c, Z_SYNC_FLUSH);
+}
+
+static int zlib_decode(stCodec_t *c, const void *in, unsigned int len, struct queue_buf *qb) {
+	z_stream *z = c->priv;
+	char out[CODEC_CHUNK];
+	unsigned int n;
+	int ret;
+
+	z->next_in = (Bytef *)in;
+	z->avail_in = len;
+	do {
+		z->next_out = (Bytef *)out;
+		z->avail_out = sizeof(out);
+		ret = inflate(z, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			log_warn("inflate: %d %s", ret, z->msg ? z->msg : "");
+			return -1;
+		}
+		n = sizeof(out) - z->avail_out;
+		/* a few compressed bytes can inflate a thousandfold */
+		if (n > c->room) {
+			log_warn("inflate: more than %u bytes from one read", CODEC_DECODE_MAX);
+			return -1;
+		}
+		if (n > 0 && queue_buf_put(qb, out, n) < 0) {
+			return -1;
+		}
+		c->room -= n;
+		c->raw += n;
+	} while (z->avail_in > 0 || z->avail_out == 0);
+	return 0;
+}
+
+static void zlib_free(stCodec_t *c) {
+	z_stream *z = c->priv;
+
+	if (z == NULL) {
+		return;
+	}
+	if (c->enc) {
+		deflateEnd(z);
+	} else {
+		inflateEnd(z);
+	}
+	FREE(z);
+}
+
+static const stCodecOps_t codecs[] = {
+	{ "deflate", zlib_init, zlib_encode, zlib_flush, zlib_decode, zlib_free },
+};
+
+static const stCodecOps_t *codec_find(const char *name) {
+	int i;
+	for (i = 0; name != NULL && i < sizeof(codecs)/sizeof(codecs[0]); i++) {
+		if (strcmp(codecs[i].name, name) == 0) {
+			return &codecs[i];
+		}
+	}
+	return NULL;
+}
+
+stCodec_t *codec_new(const char *name, int enc, const void *dict, unsigned int dlen) {
+	const stCodecOps_t *ops = codec_find(name);
+	stCodec_t *c;
+
+	if (ops == NULL) {
+		return NULL;
+	}
+	c = MALLOC(sizeof(*c));
+	if (c == NULL) {
+		return NULL;
+	}
+	memset(c, 0, sizeof(*c));
+	c->ops = ops;
+	c->enc = enc;
+	c->room = CODEC_DECODE_MAX;
+	if (ops->init(c, dict, dict != NULL ? dlen : 0) < 0) {
+		FREE(c);
+		return NULL;
+	}
+	return c;
+}
+
+void codec_free(stCodec_t *c) {
+	if (c == NULL) {
+		return;
+	}
+	c->ops->free(c);
+	FREE(c->obuf);
+	FREE(c);
+}
+
+int codec_reserve(stCodec_t *c, unsigned int len) {
+	char *p;
+
+	if (c->osize - c->olen >= len) {
+		return 0;
+	}
+	p = MALLOC(c->olen + len);
+	if (p == NULL) {
+		return -1;
+	}
+	if (c->obuf != NULL) {
+		memcpy(p, c->obuf, c->olen);
+		FREE(c->obuf);
+	}
+	c->obuf = p;
+	c->osize = c->olen + len;
+	return 0;
+}
+
+int codec_encode(stCodec_t *c, const void *in, unsigned int len) {
+	if (c->ops->encode(c, in, len) < 0) {
+		return -1;
+	}
+	c->pending += len;
+	c->raw += len;
+	return 0;
+}
+
+int codec_flush(stCodec_t *c, char **out, unsigned int *olen) {
+	*out = NULL;
+	*olen = 0;
+	if (c->pending == 0) {
+		return 0;
+	}
+	if (c->ops->flush(c) < 0) {
+		return -1;
+	}
+	c->pending = 0;
+	c->wire += c->olen;
+	/* the batch goes out as it is, the next one starts a new buffer */
+	*out = c->obuf;
+	*olen = c->olen;
+	c->obuf = NULL;
+	c->olen = 0;
+	c->osize = 0;
+	return 0;
+}
+
+int codec_decode(stCodec_t *c, const void *in, unsigned int len, struct queue_buf *qb) {
+	c->wire += len;
+	return c->ops->decode(c, in, len, qb);
+}
+
+typedef struct stCodecSink {
+	stCodec_t *c;
+	struct queue_buf *qb;
+}stCodecSink_t;
+
+static int codec_sink(void *arg, const void *buf, unsigned int len) {
+	stCodecSink_t *k = arg;
+
+	if (k->c != NULL) {
+		return codec_decode(k->c, buf, len, k->qb);
+	}
+	return queue_buf_put(k->qb, buf, len);
+}
+
+static int codec_decode_seg(const void *buf, size_t len, void *arg) {
+	stCodecSink_t *k = arg;
+
+	return codec_decode(k->c, buf, len, k->qb) < 0 ? -1 : 0;
+}
+
+/* pin what was received and decode it in place into the emptied queue */
+int codec_decode_qb(stCodec_t *c, struct queue_buf *qb) {
+	struct queue_buf_view v;
+	stCodecSink_t k = { c, qb };
+	int ret;
+
+	if (queue_buf_len(qb) == 0) {
+		return 0;
+	}
+	if (queue_buf_view_init(&v, qb, 0, queue_buf_len(qb)) < 0) {
+		return -1;
+	}
+	queue_buf_reset(qb);
+	c->room = CODEC_DECODE_MAX;
+	ret = queue_buf_view_walk(&v, codec_decode_seg, &k);
+	queue_buf_view_release(&v);
+	return ret;
+}
+
+int codec_recv(stCodec_t *c, struct stSeal *s, int fd, struct queue_buf *qb, unsigned int _size) {
+	char buf[CODEC_CHUNK];
+	stCodecSink_t k = { c, qb };
+	int ret;
+
+	if (c == NULL && s == NULL) {
+		return tcp_readv(fd, qb, _size);
+	}
+	ret = tcp_recv_nb(fd, buf, _size < sizeof(buf) ? _size : sizeof(buf));
+	if (ret <= 0) {
+		return ret;
+	}
+	if (c != NULL) {
+		c->room = CODEC_DECODE_MAX;
+	}
+	if (s != NULL) {
+		ret = seal_open(s, buf, ret, codec_sink, &k) < 0 ? -3 : ret;
+	} else if (codec_sink(&k, buf, ret) < 0) {
+		ret = -3;
+	}
+	return ret;
+}
+
+int codec_dict_load(const char *path) {
+	FILE *fp = fopen(path, "rb");
+	long size;
+
+	if (fp == NULL) {
+		log_err("open dictionary %s: %m", path);
+		return -1;
+	}
+	/* deflate only looks back 32K, keep the tail */
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, size > CODEC_DICT_MAX ? size - CODEC_DICT_MAX : 0, SEEK_SET);
+	dict_len = fread(dict_buf, 1, sizeof(dict_buf), fp);
+	fclose(fp);
+	dict_id = dict_len > 0 ? adler32(adler32(0, NULL, 0), (Bytef *)dict_buf, dict_len) : 0;
+	log_info("dictionary %s: %u bytes, id %08x", path, dict_len, dict_id);
+	return dict_len > 0 ? 0 : -1;
+}
+
+const void *codec_dict(unsigned int *len) {
+	*len = dict_len;
+	return dict_len > 0 ? dict_buf : NULL;
+}
+
+u32 codec_dict_id(void) {
+	return dict_id;
+}
+
+int codec_hello_offer(char *buf, int size, const char *name) {
+	return snprintf(buf, size, "{\"offer\":[\"%s\"],\"dict\":%u}", name, dict_id);
+}
+
+int codec_hello_answer(char *buf, int size, const char *name, int dict) {
+	return snprintf(buf, size, "{\"codec\":\"%s\",\"dict\":%u}",
+									name != NULL ? name : "none", dict ? dict_id : 0);
+}
+
+const char *codec_hello_parse(const char *spec, const char *want, int *offer, int *dict) {
+	const stCodecOps_t *ops = NULL;
+	json_t *root = json_loads(spec, 0, NULL);
+	json_t *offers, *v;
+	size_t i;
+
+	*offer = 0;
+	*dict = 0;
+	if (root == NULL) {
+		return NULL;
+	}
+	offers = json_object_get(root, "offer");
+	if (json_is_array(offers)) {
+		*offer = 1;
+		json_array_foreach(offers, i, v) {
+			if (json_is_string(v) && want != NULL && strcmp(json_string_value(v), want) == 0) {
+				ops = codec_find(want);
+				break;
+			}
+		}
+	} else if (json_is_string(json_object_get(root, "codec"))) {
+		ops = codec_find(json_string_value(json_object_get(root, "codec")));
+	}
+	v = json_object_get(root, "dict");
+	*dict = ops != NULL && dict_id != 0 && json_is_integer(v) &&
+		(u32)json_integer_value(v) == dict_id;
+	json_decref(root);
+	return ops != NULL ? ops->name : NULL;
+}
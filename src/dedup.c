@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "time_utils.h"
+#include "dedup.h"
+
+HASHMAP_FUNCS_CREATE(dedup, const stDedupEntry_t, stDedupEntry_t)
+
+/* FNV-1a, the payloads are short strings */
+static size_t dedup_hash_buf(int chan, const char *p, int len) {
+	u64 h = 14695981039346656037ULL ^ (u8)chan;
+	int i;
+	for (i = 0; i < len; i++) {
+		h = (h ^ (u8)p[i]) * 1099511628211ULL;
+	}
+	return (size_t)h;
+}
+
+static size_t dedup_hash(const void *key) {
+	return ((const stDedupEntry_t *)key)->hash;
+}
+
+static int dedup_compare(const void *a, const void *b) {
+	const stDedupEntry_t *x = a;
+	const stDedupEntry_t *y = b;
+	if (x->hash != y->hash || x->chan != y->chan || x->len != y->len) {
+		return 1;
+	}
+	return memcmp(x->data, y->data, x->len);
+}
+
+static void dedup_pop(stDedup_t *d) {
+	stDedupEntry_t *de = d->head;
+
+	d->head = de->next;
+	if (d->head == NULL) {
+		d->tail = NULL;
+	}
+	hashmap_dedup_remove(&d->map, de);
+	d->count--;
+	FREE(de);
+}
+
+static void dedup_timeout(struct timer *timer) {
+	stDedup_t *d = CONTAINER_OF(stDedup_t, timer, timer);
+	u64 now = time_mtime_ms();
+
+	while (d->head != NULL && d->head->expire <= now) {
+		dedup_pop(d);
+	}
+	if (d->head != NULL) {
+		timer_set(d->th, &d->timer, d->head->expire - now);
+	}
+}
+
+int dedup_init(stDedup_t *d, struct timer_head *th, int window) {
+	memset(d, 0, sizeof(*d));
+	d->th = th;
+	d->window = window > 0 ? window : 0;
+	timer_init(&d->timer, dedup_timeout);
+	if (hashmap_init(&d->map, dedup_hash, dedup_compare, DEDUP_MAX) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+void dedup_free(stDedup_t *d) {
+	timer_cancel(d->th, &d->timer);
+	while (d->head != NULL) {
+		dedup_pop(d);
+	}
+	hashmap_destroy(&d->map);
+}
+
+int dedup_check(stDedup_t *d, int chan, const char *topic, const char *pkt) {
+	int tlen, plen;
+	stDedupEntry_t *de, *old;
+
+	if (d->window == 0) {
+		return 0;
+	}
+	tlen = strlen(topic) + 1;
+	plen = strlen(pkt) + 1;
+	de = MALLOC(sizeof(*de) + tlen + plen);
+	if (de == NULL) {
+		/* pass it through, a missed drop is harmless */
+		return 0;
+	}
+	de->chan = chan;
+	de->len = tlen + plen;
+	memcpy(de->data, topic, tlen);
+	memcpy(de->data + tlen, pkt, plen);
+	de->hash = dedup_hash_buf(chan, de->data, de->len);
+
+	/* one lookup: put hands back the remembered copy on a repeat */
+	old = hashmap_dedup_put(&d->map, de, de);
+	if (old != de) {
+		FREE(de);
+		if (old == NULL) {
+			return 0;
+		}
+		d->hits++;
+		return 1;
+	}
+	d->misses++;
+
+	if (d->count >= DEDUP_MAX) {
+		dedup_pop(d);
+	}
+	de->next = NULL;
+	de->expire = time_mtime_ms() + d->window;
+	if (d->tail != NULL) {
+		d->tail->next = de;
+	} else {
+		d->head = de;
+		timer_set(d->th, &d->timer, d->window);
+	}
+	d->tail = de;
+	d->count++;
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "event.h"
+#include "pool.h"
+
+stEvent_t *event_packet(int _type, int _len, void *data) {
+	stEvent_t *p = (stEvent_t *)pool_alloc(sizeof(stEvent_t) + EVENT_HEADROOM + _len);
+	p->type = _type;
+	p->prio = EVENT_PRIO_NORMAL;
+	p->chan = 0;
+	p->len = _len;
+	p->data = (char *)(p+1) + EVENT_HEADROOM;
+	p->ref = 1;
+	p->release = NULL;
+	p->owner = NULL;
+	p->ts = event_now_us();
+	if (_len > 0 && data != NULL) {
+		memcpy(p->data, data, p->len);
+	}
+	return p;
+}
+
+stEvent_t *event_wrap(int _type, int _len, void *data,
+											void (*release)(void *), void *owner) {
+	stEvent_t *p = (stEvent_t *)pool_alloc(sizeof(stEvent_t));
+	p->type = _type;
+	p->prio = EVENT_PRIO_NORMAL;
+	p->chan = 0;
+	p->len = _len;
+	p->data = data;
+	p->ref = 1;
+	p->release = release;
+	p->owner = owner;
+	p->ts = event_now_us();
+	return p;
+}
+
+stEvent_t *event_get(stEvent_t *e) {
+	e->ref++;
+	return e;
+}
+
+void event_put(stEvent_t *e) {
+	if (e == NULL) {
+		return;
+	}
+	if (--e->ref > 0) {
+		return;
+	}
+	if (e->release != NULL) {
+		e->release(e->owner);
+	}
+	pool_free(e);
+}
+
+/* release callback dropping the reference held by an owner */
+void event_release(void *arg) {
+	event_put((stEvent_t *)arg);
+}
+
+u64 event_now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
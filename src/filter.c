@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "log.h"
+#include "frame.h"
+#include "route.h"
+#include "filter.h"
+
+static const char *filter_ops[] = {
+	[FILTER_EQ] = "eq",
+	[FILTER_NE] = "ne",
+	[FILTER_PREFIX] = "prefix",
+	[FILTER_EXISTS] = "exists",
+};
+
+void filter_init(stFilter_t *f) {
+	memset(f, 0, sizeof(*f));
+}
+
+void filter_free(stFilter_t *f) {
+	int i;
+
+	for (i = 0; i < f->nprefix; i++) {
+		free(f->prefix[i]);
+	}
+	for (i = 0; i < f->npred; i++) {
+		free(f->pred[i].field);
+		free(f->pred[i].value);
+	}
+	FREE(f->prefix);
+	FREE(f->plen);
+	FREE(f->pred);
+	filter_init(f);
+}
+
+static int filter_op(const char *name) {
+	int i;
+
+	if (name == NULL) {
+		return FILTER_EQ;
+	}
+	for (i = 0; i < sizeof(filter_ops)/sizeof(filter_ops[0]); i++) {
+		if (strcmp(filter_ops[i], name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int filter_compile(stFilter_t *f, const char *spec) {
+	json_error_t error;
+	json_t *root;
+	json_t *topics;
+	json_t *where;
+	json_t *item;
+	size_t i;
+	stFilter_t nf;
+
+	root = json_loads(spec, 0, &error);
+	if (root == NULL || !json_is_object(root)) {
+		log_warn("bad subscription: %s", root ? "not an object" : error.text);
+		json_decref(root);
+		return -1;
+	}
+	filter_init(&nf);
+	nf.active = 1;
+
+	topics = json_object_get(root, "topics");
+	if (json_is_array(topics) && json_array_size(topics) > 0) {
+		nf.prefix = (char **)MALLOC(json_array_size(topics) * sizeof(char *));
+		nf.plen = (int *)MALLOC(json_array_size(topics) * sizeof(int));
+		if (nf.prefix == NULL || nf.plen == NULL) {
+			goto error;
+		}
+		json_array_foreach(topics, i, item) {
+			if (!json_is_string(item)) {
+				goto error;
+			}
+			nf.prefix[nf.nprefix] = strdup(json_string_value(item));
+			if (nf.prefix[nf.nprefix] == NULL) {
+				goto error;
+			}
+			nf.plen[nf.nprefix] = strlen(nf.prefix[nf.nprefix]);
+			nf.nprefix++;
+		}
+	}
+
+	where = json_object_get(root, "where");
+	if (json_is_array(where) && json_array_size(where) > 0) {
+		nf.pred = (stFilterPred_t *)MALLOC(json_array_size(where) * sizeof(stFilterPred_t));
+		if (nf.pred == NULL) {
+			goto error;
+		}
+		json_array_foreach(where, i, item) {
+			stFilterPred_t *p = &nf.pred[nf.npred];
+			const char *field = json_string_value(json_object_get(item, "field"));
+			const char *value = json_string_value(json_object_get(item, "value"));
+			p->op = filter_op(json_string_value(json_object_get(item, "op")));
+			if (field == NULL || p->op < 0 || (p->op != FILTER_EXISTS && value == NULL)) {
+				goto error;
+			}
+			p->field = strdup(field);
+			p->value = strdup(value ? value : "");
+			nf.npred++;
+			if (p->field == NULL || p->value == NULL) {
+				goto error;
+			}
+			p->vlen = strlen(p->value);
+		}
+	}
+	json_decref(root);
+
+	/* keep the counters across re-subscriptions */
+	nf.passed = f->passed;
+	nf.dropped = f->dropped;
+	filter_free(f);
+	*f = nf;
+	return 0;
+
+error:
+	log_warn("bad subscription: %s", spec);
+	json_decref(root);
+	filter_free(&nf);
+	return -1;
+}
+
+void filter_ctx_init(stFilterCtx_t *ctx, stEvent_t *e, int dir) {
+	stRoute_t *r;
+
+	ctx->e = e;
+	ctx->root = NULL;
+	ctx->parsed = 0;
+	ctx->pkt = (const char *)e->data;
+	ctx->topic = NULL;
+	if (e->type == FRAME_TOPIC) {
+		ctx->topic = ctx->pkt;
+		ctx->pkt += strlen(ctx->topic) + 1;
+	} else if ((r = dir == ROUTE_PUB ? route_pub(e->chan) : route_sub(e->chan)) != NULL) {
+		ctx->topic = r->pattern;
+	}
+}
+
+void filter_ctx_free(stFilterCtx_t *ctx) {
+	json_decref(ctx->root);
+	ctx->root = NULL;
+}
+
+static bool filter_pred(const stFilterPred_t *p, json_t *root) {
+	json_t *v = json_object_get(root, p->field);
+	const char *s;
+	char num[32];
+
+	if (p->op == FILTER_EXISTS) {
+		return v != NULL;
+	}
+	if (json_is_string(v)) {
+		s = json_string_value(v);
+	} else if (json_is_integer(v)) {
+		snprintf(num, sizeof(num), "%lld", (long long)json_integer_value(v));
+		s = num;
+	} else if (json_is_boolean(v)) {
+		s = json_is_true(v) ? "true" : "false";
+	} else {
+		return p->op == FILTER_NE;
+	}
+	switch (p->op) {
+		case FILTER_EQ:
+			return strcmp(s, p->value) == 0;
+		case FILTER_NE:
+			return strcmp(s, p->value) != 0;
+		case FILTER_PREFIX:
+			return strncmp(s, p->value, p->vlen) == 0;
+		default:
+			return false;
+	}
+}
+
+bool filter_match(stFilter_t *f, stFilterCtx_t *ctx) {
+	int i;
+
+	if (!f->active) {
+		return true;
+	}
+	if (f->nprefix > 0) {
+		if (ctx->topic == NULL) {
+			goto drop;
+		}
+		for (i = 0; i < f->nprefix; i++) {
+			if (strncmp(ctx->topic, f->prefix[i], f->plen[i]) == 0) {
+				break;
+			}
+		}
+		if (i >= f->nprefix) {
+			goto drop;
+		}
+	}
+	if (f->npred > 0) {
+		if (!ctx->parsed) {
+			ctx->parsed = 1;
+			ctx->root = json_loads(ctx->pkt, 0, NULL);
+		}
+		if (!json_is_object(ctx->root)) {
+			goto drop;
+		}
+		for (i = 0; i < f->npred; i++) {
+			if (!filter_pred(&f->pred[i], ctx->root)) {
+				goto drop;
+			}
+		}
+	}
+	f->passed++;
+	return true;
+
+drop:
+	f->dropped++;
+	return false;
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "log.h"
+#include "buffer.h"
+#include "tcp.h"
+#include "frame.h"
+
+void frame_header(void *buf, int type, int chan, u32 len) {
+	stFrameHdr_t hdr;
+
+	hdr.magic = FRAME_MAGIC;
+	hdr.type = type;
+	hdr.chan = htons(chan);
+	hdr.len = htonl(len);
+	memcpy(buf, &hdr, sizeof(hdr));
+}
+
+void *frame_encode(stEvent_t *e, int type) {
+	u8 *p = (u8 *)e->data - FRAME_HDR_LEN;
+
+	frame_header(p, type, e->chan, e->len);
+	return p;
+}
+
+int frame_send(stTcpOut_t *out, int type, int chan, const void *data, u32 len) {
+	char *buf;
+
+	buf = (char *)MALLOC(FRAME_HDR_LEN + len);
+	if (buf == NULL) {
+		return -1;
+	}
+	frame_header(buf, type, chan, len);
+	if (len > 0) {
+		memcpy(buf + FRAME_HDR_LEN, data, len);
+	}
+	return tcp_out_send(out, buf, FRAME_HDR_LEN + len, mem_free, buf);
+}
+
+int frame_send_ctrl(stTcpOut_t *out, int type) {
+	return frame_send(out, type, CHAN_CTRL, NULL, 0);
+}
+
+/* DATA must be NUL terminated, TOPIC must hold two NUL terminated strings */
+static int frame_bad_payload(int type, const u8 *p, u32 len) {
+	switch (type) {
+		case FRAME_DATA:
+		case FRAME_SUB:
+		case FRAME_HELLO:
+			return len == 0 || p[len - 1] != 0;
+		case FRAME_REQ:
+			return len < 4 + 1 || p[len - 1] != 0;
+		case FRAME_RESP:
+			return len < sizeof(stFrameRpc_t) + 1 || p[len - 1] != 0;
+		case FRAME_TOPIC:
+			return len < 2 || p[len - 1] != 0 || memchr(p, 0, len - 1) == NULL;
+		default:
+			return 0;
+	}
+}
+
+static int frame_check(stFrameHdr_t *hdr) {
+	if (hdr->magic != FRAME_MAGIC) {
+		log_warn("bad frame magic %02x", hdr->magic);
+		return -1;
+	}
+	if (ntohl(hdr->len) > FRAME_MAX) {
+		log_warn("frame too long: %u", ntohl(hdr->len));
+		return -1;
+	}
+	if (ntohs(hdr->chan) >= CHAN_MAX) {
+		log_warn("bad channel %u", ntohs(hdr->chan));
+		return -1;
+	}
+	return 0;
+}
+
+static void frame_view_free(void *arg) {
+	queue_buf_view_release((struct queue_buf_view *)arg);
+	FREE(arg);
+}
+
+/*
+ * Complete frames in the head segment are passed on in place: a view pins
+ * the segment for a segment event and every frame becomes an event
+ * pointing at its payload, holding a reference on the segment event.
+ * Only a frame spanning segments is copied, on its own.
+ */
+int frame_recv(struct queue_buf *qb,
+							 int (*push)(stEvent_t *e, void *arg), void *arg) {
+	stFrameHdr_t hdr;
+	struct queue_buf_view *v;
+	stEvent_t *seg;
+	stEvent_t *e;
+	size_t off;
+	size_t flen;
+	u32 len;
+	int count = 0;
+	int stop = 0;
+
+	while (!stop) {
+		if (queue_buf_len(qb) < FRAME_HDR_LEN) {
+			break;
+		}
+		queue_buf_copyout(qb, &hdr, sizeof(hdr), 0);
+		if (frame_check(&hdr) < 0) {
+			return -1;
+		}
+		len = ntohl(hdr.len);
+		flen = FRAME_HDR_LEN + len;
+		if (queue_buf_len(qb) < flen) {
+			break;
+		}
+		if (qb->first->data.len < flen) {
+			e = event_packet(hdr.type, len, NULL);
+			if (len > 0) {
+				queue_buf_copyout(qb, e->data, len, FRAME_HDR_LEN);
+			}
+			queue_buf_trim_head(qb, queue_buf_len(qb) - flen);
+			if (frame_bad_payload(hdr.type, e->data, len)) {
+				log_debug("drop malformed frame type %d", hdr.type);
+				event_put(e);
+				continue;
+			}
+			e->chan = ntohs(hdr.chan);
+			count++;
+			if (push(e, arg) > 0) {
+				stop = 1;
+			}
+			continue;
+		}
+
+		v = (struct queue_buf_view *)MALLOC(sizeof(*v));
+		if (v == NULL || queue_buf_view_init(v, qb, 0, qb->first->data.len) < 0) {
+			FREE(v);
+			return -1;
+		}
+		seg = event_wrap(0, v->len, (void *)v->ptr, frame_view_free, v);
+		for (off = 0; off + FRAME_HDR_LEN <= v->len; off += flen) {
+			memcpy(&hdr, v->ptr + off, sizeof(hdr));
+			if (frame_check(&hdr) < 0) {
+				event_put(seg);
+				return -1;
+			}
+			len = ntohl(hdr.len);
+			flen = FRAME_HDR_LEN + len;
+			if (off + flen > v->len) {
+				break;
+			}
+			if (frame_bad_payload(hdr.type, v->ptr + off + FRAME_HDR_LEN, len)) {
+				log_debug("drop malformed frame type %d", hdr.type);
+				continue;
+			}
+			e = event_wrap(hdr.type, len, (void *)(v->ptr + off + FRAME_HDR_LEN),
+										 event_release, event_get(seg));
+			e->chan = ntohs(hdr.chan);
+			count++;
+			if (push(e, arg) > 0) {
+				off += flen;
+				stop = 1;
+				break;
+			}
+		}
+		/* a trailing partial frame stays in place behind the pin */
+		queue_buf_trim_head(qb, queue_buf_len(qb) - off);
+		event_put(seg);
+	}
+	return count;
+}
@@ -0,0 +1,41 @@
+#include "heartbeat.h"
+
+static void heartbeat_timeout(struct timer *t) {
+	stHeartbeat_t *hb = CONTAINER_OF(stHeartbeat_t, timer, t);
+
+	if (hb->rx) {
+		hb->rx = 0;
+		hb->missed = 0;
+	} else if (++hb->missed >= hb->limit) {
+		hb->dead(hb);
+		return;
+	} else {
+		hb->ping(hb);
+	}
+	timer_set(hb->th, &hb->timer, hb->interval);
+}
+
+void heartbeat_init(stHeartbeat_t *hb, struct timer_head *th,
+										int interval, int limit,
+										void (*ping)(stHeartbeat_t *), void (*dead)(stHeartbeat_t *),
+										void *arg) {
+	timer_init(&hb->timer, heartbeat_timeout);
+	hb->th = th;
+	hb->interval = interval > 0 ? interval : HEARTBEAT_INTERVAL;
+	hb->limit = limit > 0 ? limit : HEARTBEAT_LIMIT;
+	hb->missed = 0;
+	hb->rx = 0;
+	hb->ping = ping;
+	hb->dead = dead;
+	hb->arg = arg;
+}
+
+void heartbeat_start(stHeartbeat_t *hb) {
+	hb->missed = 0;
+	hb->rx = 0;
+	timer_set(hb->th, &hb->timer, hb->interval);
+}
+
+void heartbeat_stop(stHeartbeat_t *hb) {
+	timer_cancel(hb->th, &hb->timer);
+}
@@ -5,13 +5,37 @@ void list_init(stList_t *l) {
 
   l->head = l->tail = NULL;
   l->size = 0;
+  l->cache = NULL;
+  l->ncache = 0;
+}
+
+static stListItem_t *list_item_get(stList_t *l) {
+  stListItem_t *pi = l->cache;
+
+  if (pi != NULL) {
+    l->cache = pi->next;
+    l->ncache--;
+    return pi;
+  }
+  pi = (stListItem_t *)MALLOC(sizeof(stListItem_t));
+  ASSERT(pi != NULL);
+  return pi;
+}
+
+static void list_item_put(stList_t *l, stListItem_t *pi) {
+  if (l->ncache >= LIST_CACHE_MAX) {
+    FREE(pi);
+    return;
+  }
+  pi->next = l->cache;
+  l->cache = pi;
+  l->ncache++;
 }
 
 bool list_push_front(stList_t *l, void *data) {
   ASSERT(l != NULL);
   
-  stListItem_t *pi = (stListItem_t *)MALLOC(sizeof(stListItem_t));
-  ASSERT(pi != NULL);
+  stListItem_t *pi = list_item_get(l);
   
   pi->data = data;
   pi->next = NULL;
@@ -33,8 +57,7 @@ bool list_push_front(stList_t *l, void *data) {
 bool list_push_back(stList_t *l, void *data) {
   ASSERT(l != NULL);
   
-  stListItem_t *pi = (stListItem_t *)MALLOC(sizeof(stListItem_t));
-  ASSERT(pi != NULL);
+  stListItem_t *pi = list_item_get(l);
   
   pi->data = data;
   pi->next = NULL;
@@ -77,7 +100,7 @@ bool list_pop_front(stList_t *l, void **data) {
 
     *data = pi->data;
     
-    FREE(pi);
+    list_item_put(l, pi);
     
     ret = true;
   }
@@ -109,7 +132,7 @@ bool list_pop_back(stList_t *l, void **data) {
 
     *data = pi->data;
     
-    FREE(pi);
+    list_item_put(l, pi);
     
     ret = true;
   }
@@ -159,8 +182,7 @@ bool list_peek_back(stList_t *l, void **data) {
 void list_destroy(stList_t *l, void (*freefunc)(void *)) {
   ASSERT(l != NULL);
   
-  stListItem_t *pi = (stListItem_t *)MALLOC(sizeof(stListItem_t));
-  pi = l->head;
+  stListItem_t *pi = l->head;
   
   while (pi != NULL) {
     l->head = pi->next;
@@ -175,10 +197,16 @@ void list_destroy(stList_t *l, void (*freefunc)(void *)) {
     FREE(pi);
     l->size--;
     
-    pi = l->head->next;
+    pi = l->head;
   }
   l->tail = l->head;
 
+  while ((pi = l->cache) != NULL) {
+    l->cache = pi->next;
+    FREE(pi);
+  }
+  l->ncache = 0;
+
   ASSERT(l->size == 0);
   ASSERT(l->tail == NULL);
 }
@@ -192,3 +220,65 @@ bool list_empty(stList_t *l) {
   ASSERT(l != NULL);
 	return (list_size(l) == 0);
 }
+
+void ilist_init(stIList_t *l) {
+  l->head = l->tail = NULL;
+  l->size = 0;
+}
+
+void ilist_push_front(stIList_t *l, stListNode_t *n) {
+  n->prev = NULL;
+  n->next = l->head;
+  if (l->head != NULL) {
+    l->head->prev = n;
+  } else {
+    l->tail = n;
+  }
+  l->head = n;
+  l->size++;
+}
+
+void ilist_push_back(stIList_t *l, stListNode_t *n) {
+  n->next = NULL;
+  n->prev = l->tail;
+  if (l->tail != NULL) {
+    l->tail->next = n;
+  } else {
+    l->head = n;
+  }
+  l->tail = n;
+  l->size++;
+}
+
+void ilist_remove(stIList_t *l, stListNode_t *n) {
+  if (n->prev != NULL) {
+    n->prev->next = n->next;
+  } else {
+    l->head = n->next;
+  }
+  if (n->next != NULL) {
+    n->next->prev = n->prev;
+  } else {
+    l->tail = n->prev;
+  }
+  n->prev = n->next = NULL;
+  l->size--;
+}
+
+stListNode_t *ilist_pop_front(stIList_t *l) {
+  stListNode_t *n = l->head;
+
+  if (n != NULL) {
+    ilist_remove(l, n);
+  }
+  return n;
+}
+
+stListNode_t *ilist_pop_back(stIList_t *l) {
+  stListNode_t *n = l->tail;
+
+  if (n != NULL) {
+    ilist_remove(l, n);
+  }
+  return n;
+}
@@ -1,6 +1,187 @@
+#include <string.h>
+
 #include "lockqueue.h"
 #include "common.h"
 
+#ifdef LOCKQUEUE_RING
+
+#define LQ_LOAD(p)			__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define LQ_STORE(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/*
+ * Bounded ring after Vyukov: a slot's seq is its position while free and
+ * position + 1 once its element is published.  Producers claim positions
+ * with a CAS on tail, the consumer owns head.
+ */
+void lockqueue_init(stLockQueue_t *lq) {
+  unsigned long i;
+
+  memset(lq, 0, sizeof(*lq));
+  lq->ring = (stLockQueueSlot_t *)MALLOC(sizeof(stLockQueueSlot_t) * LOCKQUEUE_RING_SIZE);
+  ASSERT(lq->ring != NULL);
+  for (i = 0; i < LOCKQUEUE_RING_SIZE; i++) {
+    lq->ring[i].seq = i;
+  }
+  lq->mask = LOCKQUEUE_RING_SIZE - 1;
+  mutex_init(&lq->mtx);
+  cond_init(&lq->cond);
+  list_init(&lq->list);
+}
+
+static bool ring_push(stLockQueue_t *lq, void *elem) {
+  unsigned long pos = __atomic_load_n(&lq->tail, __ATOMIC_RELAXED);
+  stLockQueueSlot_t *s;
+  long dif;
+
+  for (;;) {
+    s = &lq->ring[pos & lq->mask];
+    dif = (long)(LQ_LOAD(&s->seq) - pos);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&lq->tail, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return false; //full
+    } else {
+      pos = __atomic_load_n(&lq->tail, __ATOMIC_RELAXED);
+    }
+  }
+  s->elem = elem;
+  LQ_STORE(&s->seq, pos + 1);
+  return true;
+}
+
+static bool ring_peek(stLockQueue_t *lq, void **elem) {
+  stLockQueueSlot_t *s = &lq->ring[lq->head & lq->mask];
+
+  if (LQ_LOAD(&s->seq) != lq->head + 1) {
+    return false;
+  }
+  *elem = s->elem;
+  return true;
+}
+
+static bool ring_pop(stLockQueue_t *lq, void **elem) {
+  unsigned long pos = lq->head;
+
+  if (!ring_peek(lq, elem)) {
+    return false;
+  }
+  LQ_STORE(&lq->ring[pos & lq->mask].seq, pos + lq->mask + 1);
+  LQ_STORE(&lq->head, pos + 1);
+  return true;
+}
+
+/* the newest element, given back to its position.  A producer still
+ * filling the newest slot or claiming the next one makes us retry, the
+ * ring is only empty when tail meets head */
+static bool ring_pop_back(stLockQueue_t *lq, void **elem) {
+  unsigned long pos = LQ_LOAD(&lq->tail);
+  stLockQueueSlot_t *s;
+
+  for (;;) {
+    if (pos == lq->head) {
+      return false;
+    }
+    s = &lq->ring[(pos - 1) & lq->mask];
+    if (LQ_LOAD(&s->seq) != pos) {
+      pos = LQ_LOAD(&lq->tail);
+      continue;
+    }
+    *elem = s->elem;
+    /* a failed CAS reloads pos */
+    if (__atomic_compare_exchange_n(&lq->tail, &pos, pos - 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+  }
+  LQ_STORE(&s->seq, pos - 1);
+  return true;
+}
+
+void lockqueue_push(stLockQueue_t *lq, void *elem) {
+  if (LQ_LOAD(&lq->spilled) == 0 && ring_push(lq, elem)) {
+    return;
+  }
+  mutex_lock(&lq->mtx);
+  list_push_front(&lq->list, elem);
+  LQ_STORE(&lq->spilled, lq->spilled + 1);
+  mutex_unlock(&lq->mtx);
+}
+
+bool lockqueue_try_push(stLockQueue_t *lq, void *elem) {
+  if (LQ_LOAD(&lq->spilled) != 0) {
+    return false;
+  }
+  return ring_push(lq, elem);
+}
+
+static bool spill_pop(stLockQueue_t *lq, void **elem, bool back) {
+  bool ret;
+
+  if (LQ_LOAD(&lq->spilled) == 0) {
+    return false;
+  }
+  mutex_lock(&lq->mtx);
+  ret = back ? list_pop_front(&lq->list, elem) : list_pop_back(&lq->list, elem);
+  if (ret) {
+    LQ_STORE(&lq->spilled, lq->spilled - 1);
+  }
+  mutex_unlock(&lq->mtx);
+  return ret;
+}
+
+bool lockqueue_pop(stLockQueue_t *lq, void **elem) {
+  /* spilled elements are younger than everything in the ring */
+  return ring_pop(lq, elem) || spill_pop(lq, elem, false);
+}
+
+bool lockqueue_pop_back(stLockQueue_t *lq, void **elem) {
+  return spill_pop(lq, elem, true) || ring_pop_back(lq, elem);
+}
+
+bool lockqueue_peek(stLockQueue_t *lq, void **elem) {
+  bool ret;
+
+  if (ring_peek(lq, elem)) {
+    return true;
+  }
+  if (LQ_LOAD(&lq->spilled) == 0) {
+    return false;
+  }
+  mutex_lock(&lq->mtx);
+  ret = list_peek_back(&lq->list, elem);
+  mutex_unlock(&lq->mtx);
+  return ret;
+}
+
+void lockqueue_destroy(stLockQueue_t *lq, void (*free_elem)(void*)) {
+  void *elem;
+
+  while (ring_pop(lq, &elem)) {
+    if (free_elem != NULL) {
+      free_elem(elem);
+    }
+  }
+  FREE(lq->ring);
+  lq->ring = NULL;
+  mutex_lock(&lq->mtx);
+  list_destroy(&lq->list, free_elem);
+  lq->spilled = 0;
+  mutex_unlock(&lq->mtx);
+
+  mutex_destroy(&lq->mtx);
+  cond_destroy(&lq->cond);
+}
+
+int    lockqueue_size(stLockQueue_t *lq) {
+  unsigned long head = LQ_LOAD(&lq->head);
+
+  return (int)(LQ_LOAD(&lq->tail) - head) + LQ_LOAD(&lq->spilled);
+}
+
+#else
 
 void lockqueue_init(stLockQueue_t *lq) {
   mutex_init(&lq->mtx);
@@ -12,6 +193,10 @@ void lockqueue_push(stLockQueue_t *lq, void *elem) {
 	list_push_front(&lq->list, elem);
   mutex_unlock(&lq->mtx);
 }
+bool lockqueue_try_push(stLockQueue_t *lq, void *elem) {
+  lockqueue_push(lq, elem); //unbounded
+  return true;
+}
 bool lockqueue_pop(stLockQueue_t *lq, void **elem) {
   bool ret = false;
   mutex_lock(&lq->mtx);
@@ -32,6 +217,16 @@ bool lockqueue_pop_back(stLockQueue_t *lq, void **elem) {
   mutex_unlock(&lq->mtx);
   return ret;
 }
+bool lockqueue_peek(stLockQueue_t *lq, void **elem) {
+  bool ret = false;
+  mutex_lock(&lq->mtx);
+	if (!list_empty(&lq->list)) {
+    list_peek_back(&lq->list, elem);
+    ret = true;
+  }
+  mutex_unlock(&lq->mtx);
+  return ret;
+}
 void lockqueue_destroy(stLockQueue_t *lq, void (*free_elem)(void*)) {
   mutex_lock(&lq->mtx);
   list_destroy(&lq->list, free_elem);
@@ -41,6 +236,24 @@ void lockqueue_destroy(stLockQueue_t *lq, void (*free_elem)(void*)) {
   cond_destroy(&lq->cond);
 }
 
+int    lockqueue_size(stLockQueue_t *lq) {
+  int size;
+  mutex_lock(&lq->mtx);
+  size = list_size(&lq->list);
+  mutex_unlock(&lq->mtx);
+  return size;
+}
+
+#endif
+
+int lockqueue_pop_batch(stLockQueue_t *lq, void **elems, int max) {
+  int n = 0;
+  while (n < max && lockqueue_pop(lq, &elems[n])) {
+    n++;
+  }
+  return n;
+}
+
 void lockqueue_wake(stLockQueue_t *lq) {
 	cond_wake(&lq->cond);
 }
@@ -49,10 +262,6 @@ void lockqueue_wait(stLockQueue_t *lq) {
 	cond_wait(&lq->cond);
 }
 
-int    lockqueue_size(stLockQueue_t *lq) {
-  return list_size(&lq->list);
-}
-
 bool lockqueue_empty(stLockQueue_t *lq) {
 	return (lockqueue_size(lq) == 0);
 }
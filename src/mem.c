@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "pool.h"
+#include "log.h"
+
+typedef struct stMemOps {
+	const char *name;
+	void *(*alloc)(size_t size, const char *file, int line);
+	void (*free)(void *p);
+}stMemOps_t;
+
+/* in front of debug blocks, keeps the payload 16 byte aligned */
+typedef struct stMemHdr {
+	stMemSite_t *site;
+	size_t size;
+}stMemHdr_t;
+
+typedef struct stMemEnv {
+	const stMemOps_t *ops;
+	int used;
+	u64 allocs;
+	u64 frees;
+	size_t bytes;
+	size_t peak;
+	pthread_mutex_t lock;
+	stMemSite_t sites[MEM_SITE_MAX];
+	stMemSite_t other;	/* once the site table is full */
+}stMemEnv_t;
+
+static stMemEnv_t me = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.other = { .file = "other" },
+};
+
+static void *sys_alloc(size_t size, const char *file, int line) {
+	return malloc(size);
+}
+
+static void *pl_alloc(size_t size, const char *file, int line) {
+	return pool_alloc(size);
+}
+
+static stMemSite_t *dbg_site(const char *file, int line) {
+	u32 h = ((uintptr_t)file >> 4) * 31 + line;
+	int i, n;
+
+	for (n = 0; n < MEM_SITE_MAX; n++) {
+		i = (h + n) % MEM_SITE_MAX;
+		if (me.sites[i].file == NULL) {
+			me.sites[i].file = file;
+			me.sites[i].line = line;
+			return &me.sites[i];
+		}
+		if (me.sites[i].file == file && me.sites[i].line == line) {
+			return &me.sites[i];
+		}
+	}
+	return &me.other;
+}
+
+static void *dbg_alloc(size_t size, const char *file, int line) {
+	stMemHdr_t *h = malloc(sizeof(*h) + size);
+	stMemSite_t *s;
+
+	if (h == NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&me.lock);
+	s = dbg_site(file, line);
+	s->allocs++;
+	s->live++;
+	s->bytes += size;
+	if (s->bytes > s->peak) {
+		s->peak = s->bytes;
+	}
+	me.bytes += size;
+	if (me.bytes > me.peak) {
+		me.peak = me.bytes;
+	}
+	pthread_mutex_unlock(&me.lock);
+	h->site = s;
+	h->size = size;
+	return h + 1;
+}
+
+static void dbg_free(void *p) {
+	stMemHdr_t *h = (stMemHdr_t *)p - 1;
+
+	pthread_mutex_lock(&me.lock);
+	h->site->live--;
+	h->site->bytes -= h->size;
+	me.bytes -= h->size;
+	pthread_mutex_unlock(&me.lock);
+	free(h);
+}
+
+static const stMemOps_t mem_ops[] = {
+	{ "system", sys_alloc, free },
+	{ "pool", pl_alloc, pool_free },
+	{ "debug", dbg_alloc, dbg_free },
+};
+
+static const stMemOps_t *mem_find(const char *name) {
+	int i;
+	for (i = 0; i < sizeof(mem_ops) / sizeof(mem_ops[0]); i++) {
+		if (strcmp(mem_ops[i].name, name) == 0) {
+			return &mem_ops[i];
+		}
+	}
+	return NULL;
+}
+
+static const stMemOps_t *mem_get(void) {
+	const stMemOps_t *ops = __atomic_load_n(&me.ops, __ATOMIC_ACQUIRE);
+	const char *name;
+
+	if (ops == NULL) {
+		name = getenv("BRIDGE_ALLOC");
+		if (name == NULL || (ops = mem_find(name)) == NULL) {
+			ops = mem_find(MEM_DEFAULT);
+		}
+		if (ops == NULL) {
+			ops = &mem_ops[0];
+		}
+		__atomic_store_n(&me.ops, ops, __ATOMIC_RELEASE);
+	}
+	return ops;
+}
+
+int mem_select(const char *name) {
+	const stMemOps_t *ops = mem_find(name);
+
+	if (ops == NULL) {
+		log_warn("unknown allocator: %s", name);
+		return -1;
+	}
+	if (__atomic_load_n(&me.used, __ATOMIC_ACQUIRE) && ops != mem_get()) {
+		log_warn("allocator %s already in use", mem_get()->name);
+		return -2;
+	}
+	__atomic_store_n(&me.ops, ops, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void *mem_alloc(size_t size, const char *file, int line) {
+	const stMemOps_t *ops = mem_get();
+	void *p;
+
+	if (!me.used) {
+		__atomic_store_n(&me.used, 1, __ATOMIC_RELEASE);
+	}
+	p = ops->alloc(size, file, line);
+	if (p != NULL) {
+		__atomic_fetch_add(&me.allocs, 1, __ATOMIC_RELAXED);
+	}
+	return p;
+}
+
+void mem_free(void *p) {
+	if (p == NULL) {
+		return;
+	}
+	__atomic_fetch_add(&me.frees, 1, __ATOMIC_RELAXED);
+	mem_get()->free(p);
+}
+
+void mem_stats(stMemStats_t *st) {
+	st->name = mem_get()->name;
+	st->allocs = __atomic_load_n(&me.allocs, __ATOMIC_RELAXED);
+	st->frees = __atomic_load_n(&me.frees, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&me.lock);
+	st->bytes = me.bytes;
+	st->peak = me.peak;
+	pthread_mutex_unlock(&me.lock);
+}
+
+int mem_sites(stMemSite_t *sites, int max) {
+	int i, n = 0;
+
+	pthread_mutex_lock(&me.lock);
+	for (i = 0; i < MEM_SITE_MAX && n < max; i++) {
+		if (me.sites[i].file != NULL) {
+			sites[n++] = me.sites[i];
+		}
+	}
+	if (me.other.allocs > 0 && n < max) {
+		sites[n++] = me.other;
+	}
+	pthread_mutex_unlock(&me.lock);
+	return n;
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "frame.h"
+#include "filter.h"
+#include "dedup.h"
+#include "ratelimit.h"
+#include "json_parser.h"
+#include "pipe.h"
+
+static stPipe_t *pipes;
+
+/* stage "filter": drop what a filter.h spec does not match */
+static int filter_stage_init(stPipeStage_t *s, json_t *conf) {
+	stFilter_t *f = MALLOC(sizeof(*f));
+	char *spec = json_dumps(conf, JSON_COMPACT);
+	int ret = -1;
+
+	/* filter_init clears f */
+	if (f != NULL && spec != NULL) {
+		filter_init(f);
+		ret = filter_compile(f, spec);
+	}
+	free(spec);
+	if (ret < 0) {
+		FREE(f);
+		return -1;
+	}
+	s->priv = f;
+	return 0;
+}
+
+static int filter_stage_push(stPipeStage_t *s, stEvent_t **ev, int n) {
+	stFilter_t *f = s->priv;
+	stFilterCtx_t fctx;
+	int i, k = 0;
+
+	for (i = 0; i < n; i++) {
+		filter_ctx_init(&fctx, ev[i], s->pipe->dir);
+		if (filter_match(f, &fctx)) {
+			ev[k++] = ev[i];
+		} else {
+			s->dropped++;
+			event_put(ev[i]);
+		}
+		filter_ctx_free(&fctx);
+	}
+	return k;
+}
+
+static void filter_stage_free(stPipeStage_t *s) {
+	filter_free(s->priv);
+	FREE(s->priv);
+}
+
+/* stage "dedup": drop repeats within "window" ms, see dedup.h */
+static int dedup_stage_init(stPipeStage_t *s, json_t *conf) {
+	stDedup_t *d;
+	int window = 0;
+
+	if (json_get_int(conf, "window", &window) < 0 || window <= 0) {
+		return -1;
+	}
+	d = MALLOC(sizeof(*d));
+	if (d == NULL || dedup_init(d, s->pipe->th, window) < 0) {
+		FREE(d);
+		return -1;
+	}
+	s->priv = d;
+	return 0;
+}
+
+static int dedup_stage_push(stPipeStage_t *s, stEvent_t **ev, int n) {
+	const char *topic, *pkt;
+	int i, k = 0;
+
+	for (i = 0; i < n; i++) {
+		/* a DATA frame's topic is the one of its channel's route */
+		topic = "";
+		pkt = ev[i]->data;
+		if (ev[i]->type == FRAME_TOPIC) {
+			topic = pkt;
+			pkt += strlen(topic) + 1;
+		}
+		if (dedup_check(s->priv, ev[i]->chan, topic, pkt)) {
+			s->dropped++;
+			event_put(ev[i]);
+		} else {
+			ev[k++] = ev[i];
+		}
+	}
+	return k;
+}
+
+static void dedup_stage_free(stPipeStage_t *s) {
+	dedup_free(s->priv);
+	FREE(s->priv);
+}
+
+/* stage "ratelimit": a ratelimit.h limiter whose hold queue the pipe timer runs */
+static int rate_stage_init(stPipeStage_t *s, json_t *conf) {
+	stRateLimit_t *rl;
+	int rate = 0, burst = 0, qmax = 0, policy = RATE_SHAPE;
+	const char *p = json_get_string(conf, "policy");
+
+	if (json_get_int(conf, "rate", &rate) < 0 || rate <= 0) {
+		return -1;
+	}
+	json_get_int(conf, "burst", &burst);
+	json_get_int(conf, "queue", &qmax);
+	if (p != NULL && strcmp(p, "police") == 0) {
+		policy = RATE_POLICE;
+	} else if (p != NULL && strcmp(p, "shape") != 0) {
+		return -1;
+	}
+	rl = MALLOC(sizeof(*rl));
+	if (rl == NULL) {
+		return -1;
+	}
+	ratelimit_init(rl, NULL, rate, burst, policy, qmax, NULL);
+	s->priv = rl;
+	return 0;
+}
+
+static int rate_stage_push(stPipeStage_t *s, stEvent_t **ev, int n) {
+	stRateLimit_t *rl = s->priv;
+	int i, ret, k = 0;
+
+	for (i = 0; i < n; i++) {
+		ret = ratelimit_admit(rl, ev[i]);
+		if (ret > 0) {
+			ev[k++] = ev[i];
+		} else if (ret < 0) {
+			s->dropped++;
+		}
+	}
+	if (rl->held > 0) {
+		pipe_wake(s, ratelimit_retry(rl));
+	}
+	return k;
+}
+
+static int rate_stage_drain(stPipeStage_t *s, stEvent_t **ev, int n) {
+	stRateLimit_t *rl = s->priv;
+	int k = 0;
+
+	while (k < n && (ev[k] = ratelimit_release(rl)) != NULL) {
+		k++;
+	}
+	if (rl->held > 0 && k < n) {
+		pipe_wake(s, ratelimit_retry(rl));
+	}
+	return k;
+}
+
+static void rate_stage_free(stPipeStage_t *s) {
+	ratelimit_free(s->priv);
+	FREE(s->priv);
+}
+
+static const stPipeOps_t stages[] = {
+	{ "filter", filter_stage_init, filter_stage_push, NULL, filter_stage_free },
+	{ "dedup", dedup_stage_init, dedup_stage_push, NULL, dedup_stage_free },
+	{ "ratelimit", rate_stage_init, rate_stage_push, rate_stage_drain, rate_stage_free },
+};
+
+/* run ev through s and the stages after it into the sink */
+static int pipe_run(stPipe_t *p, stPipeStage_t *s, stEvent_t **ev, int n) {
+	int i, ret = 0;
+
+	for (; s != NULL && n > 0; s = s->next) {
+		s->in += n;
+		n = s->ops->push(s, ev, n);
+		s->out += n;
+	}
+	for (i = 0; i < n; i++) {
+		if (p->sink(ev[i]) < 0) {
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+static void pipe_timeout(struct timer *timer) {
+	stPipe_t *p = CONTAINER_OF(stPipe_t, timer, timer);
+	stEvent_t *ev[PIPE_BATCH];
+	stPipeStage_t *s;
+	int n;
+
+	for (s = p->head; s != NULL; s = s->next) {
+		if (s->ops->drain == NULL) {
+			continue;
+		}
+		do {
+			n = s->ops->drain(s, ev, PIPE_BATCH);
+			s->out += n;
+			pipe_run(p, s->next, ev, n);
+		} while (n == PIPE_BATCH);
+	}
+}
+
+void pipe_init(stPipe_t *p, const char *name, int dir, struct timer_head *th,
+							 int (*sink)(stEvent_t *e)) {
+	memset(p, 0, sizeof(*p));
+	p->name = name;
+	p->dir = dir;
+	p->th = th;
+	p->sink = sink;
+	timer_init(&p->timer, pipe_timeout);
+	p->next = pipes;
+	pipes = p;
+}
+
+void pipe_free(stPipe_t *p) {
+	stPipeStage_t *s;
+	stPipe_t **pp;
+
+	timer_cancel(p->th, &p->timer);
+	while ((s = p->head) != NULL) {
+		p->head = s->next;
+		s->ops->free(s);
+		FREE(s);
+	}
+	p->tail = NULL;
+	p->count = 0;
+	for (pp = &pipes; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == p) {
+			*pp = p->next;
+			break;
+		}
+	}
+}
+
+int pipe_add(stPipe_t *p, const char *name, json_t *conf) {
+	const stPipeOps_t *ops = NULL;
+	stPipeStage_t *s;
+	int i;
+
+	for (i = 0; name != NULL && i < sizeof(stages)/sizeof(stages[0]); i++) {
+		if (strcmp(stages[i].name, name) == 0) {
+			ops = &stages[i];
+			break;
+		}
+	}
+	if (ops == NULL) {
+		log_err("pipe %s: unknown stage %s", p->name, name ? name : "(null)");
+		return -1;
+	}
+	s = MALLOC(sizeof(*s));
+	if (s == NULL) {
+		return -1;
+	}
+	memset(s, 0, sizeof(*s));
+	s->ops = ops;
+	s->pipe = p;
+	if (ops->init(s, conf) < 0) {
+		log_err("pipe %s: bad %s stage", p->name, name);
+		FREE(s);
+		return -1;
+	}
+	if (p->tail != NULL) {
+		p->tail->next = s;
+	} else {
+		p->head = s;
+	}
+	p->tail = s;
+	p->count++;
+	log_info("pipe %s: stage %d %s", p->name, p->count, name);
+	return 0;
+}
+
+int pipe_push(stPipe_t *p, stEvent_t *e) {
+	if (p->head == NULL) {
+		return p->sink(e);
+	}
+	return pipe_run(p, p->head, &e, 1);
+}
+
+int pipe_push_batch(stPipe_t *p, stEvent_t **ev, int n) {
+	return pipe_run(p, p->head, ev, n);
+}
+
+void pipe_wake(stPipeStage_t *s, u32 ms) {
+	stPipe_t *p = s->pipe;
+
+	if (timer_active(&p->timer) && timer_delay_get_ms(&p->timer) <= ms) {
+		return;
+	}
+	timer_set(p->th, &p->timer, ms);
+}
+
+int pipe_conf_set(json_t *obj) {
+	const char *key;
+	json_t *arr, *item;
+	stPipe_t *p;
+	size_t i;
+
+	json_object_foreach(obj, key, arr) {
+		for (p = pipes; p != NULL && strcmp(p->name, key) != 0; p = p->next) {
+		}
+		if (p == NULL || !json_is_array(arr)) {
+			log_err("bad pipeline %s", key);
+			return -1;
+		}
+		json_array_foreach(arr, i, item) {
+			if (pipe_add(p, json_get_string(item, "stage"), item) < 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
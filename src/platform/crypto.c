@@ -41,3 +41,16 @@ int platform_crypto_init_aes(struct crypto_state *state,
 	log_debug("~~~~~~~~~~~~platform implement : [%s]", __func__);
 	return -1;
 }
+
+/*
+ * Initialize a custom crypto context for AES GCM authenticated encryption.
+ * The message layout and nonce rules are the ones of crypto_init_aes_gcm().
+ * Return 0 for success, and -1 for failure or if not implemented.
+ */
+int platform_crypto_init_aes_gcm(struct crypto_state *state,
+	const u8 *key, size_t key_len)
+{
+	/* No platform-specific crypto: defaults to Openssl */
+	log_debug("~~~~~~~~~~~~platform implement : [%s]", __func__);
+	return -1;
+}
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "pool.h"
+
+#define POOL_LARGE		0xffffffff
+
+/* in front of every block, keeps the payload 16 byte aligned */
+typedef struct stPoolHdr {
+	struct stPoolHdr *next;	/* while on a free list */
+	u32 cls;
+	u32 pad;
+}stPoolHdr_t;
+
+static const u32 pool_sizes[POOL_NCLASS] = POOL_SIZES;
+static stPoolStats_t pool_st[POOL_NCLASS + 1];
+static __thread stPoolHdr_t *pool_cache[POOL_NCLASS];
+
+static int pool_class(size_t size) {
+	int c;
+	for (c = 0; c < POOL_NCLASS; c++) {
+		if (size <= pool_sizes[c]) {
+			return c;
+		}
+	}
+	return -1;
+}
+
+static void pool_count(stPoolStats_t *st, int hit) {
+	u32 n, high;
+
+	__atomic_fetch_add(&st->allocs, 1, __ATOMIC_RELAXED);
+	if (hit) {
+		__atomic_fetch_add(&st->hits, 1, __ATOMIC_RELAXED);
+	}
+	n = __atomic_add_fetch(&st->in_use, 1, __ATOMIC_RELAXED);
+	high = __atomic_load_n(&st->high, __ATOMIC_RELAXED);
+	while (n > high && !__atomic_compare_exchange_n(&st->high, &high, n, true,
+																									__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+}
+
+/* a new slab of class c onto this thread's free list */
+static int pool_carve(int c) {
+	size_t bsize = sizeof(stPoolHdr_t) + pool_sizes[c];
+	int n = POOL_SLAB / bsize;
+	stPoolHdr_t *h;
+	char *slab;
+	int i;
+
+	if (n < 1) {
+		n = 1;
+	}
+	slab = malloc(bsize * n);
+	if (slab == NULL) {
+		return -1;
+	}
+	for (i = n - 1; i >= 0; i--) {
+		h = (stPoolHdr_t *)(slab + i * bsize);
+		h->cls = c;
+		h->next = pool_cache[c];
+		pool_cache[c] = h;
+	}
+	__atomic_fetch_add(&pool_st[c].slabs, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+void *pool_alloc(size_t size) {
+	int c = pool_class(size);
+	stPoolHdr_t *h;
+	int hit = 1;
+
+	if (c < 0) {
+		h = malloc(sizeof(*h) + size);
+		if (h == NULL) {
+			return NULL;
+		}
+		h->cls = POOL_LARGE;
+		pool_count(&pool_st[POOL_NCLASS], 0);
+		return h + 1;
+	}
+	if (pool_cache[c] == NULL) {
+		hit = 0;
+		if (pool_carve(c) < 0) {
+			return NULL;
+		}
+	}
+	h = pool_cache[c];
+	pool_cache[c] = h->next;
+	pool_count(&pool_st[c], hit);
+	return h + 1;
+}
+
+void pool_free(void *p) {
+	stPoolHdr_t *h;
+
+	if (p == NULL) {
+		return;
+	}
+	h = (stPoolHdr_t *)p - 1;
+	if (h->cls == POOL_LARGE) {
+		__atomic_fetch_sub(&pool_st[POOL_NCLASS].in_use, 1, __ATOMIC_RELAXED);
+		free(h);
+		return;
+	}
+	__atomic_fetch_sub(&pool_st[h->cls].in_use, 1, __ATOMIC_RELAXED);
+	h->next = pool_cache[h->cls];
+	pool_cache[h->cls] = h;
+}
+
+int pool_stats(stPoolStats_t *st, int max) {
+	int c;
+
+	for (c = 0; c <= POOL_NCLASS && c < max; c++) {
+		st[c].size = c < POOL_NCLASS ? pool_sizes[c] : 0;
+		st[c].in_use = __atomic_load_n(&pool_st[c].in_use, __ATOMIC_RELAXED);
+		st[c].high = __atomic_load_n(&pool_st[c].high, __ATOMIC_RELAXED);
+		st[c].slabs = __atomic_load_n(&pool_st[c].slabs, __ATOMIC_RELAXED);
+		st[c].allocs = __atomic_load_n(&pool_st[c].allocs, __ATOMIC_RELAXED);
+		st[c].hits = __atomic_load_n(&pool_st[c].hits, __ATOMIC_RELAXED);
+	}
+	return c;
+}
@@ -0,0 +1,150 @@
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "time_utils.h"
+#include "ratelimit.h"
+
+#define TB_UNIT		1000
+
+void tbucket_init(stTokenBucket_t *tb, u32 rate, u32 burst) {
+	tb->rate = rate;
+	tb->burst = burst > 0 ? burst : rate;
+	tb->tokens = (s64)tb->burst * TB_UNIT;
+	tb->last = time_mtime_ms();
+}
+
+static void tbucket_refill(stTokenBucket_t *tb) {
+	u64 now = time_mtime_ms();
+	s64 max = (s64)tb->burst * TB_UNIT;
+
+	/* rate tokens per second is rate units per ms */
+	tb->tokens += (s64)(now - tb->last) * tb->rate;
+	tb->last = now;
+	if (tb->tokens > max) {
+		tb->tokens = max;
+	}
+}
+
+/* a full bucket earned nothing while idle, restart its refill clock */
+static inline void tbucket_spend(stTokenBucket_t *tb, s64 need) {
+	if (tb->tokens >= (s64)tb->burst * TB_UNIT) {
+		tb->last = time_mtime_ms();
+	}
+	tb->tokens -= need;
+}
+
+int tbucket_take(stTokenBucket_t *tb, u32 n) {
+	s64 need = (s64)n * TB_UNIT;
+
+	if (tb->rate == 0) {
+		return 1;
+	}
+	if (tb->tokens < need) {
+		tbucket_refill(tb);
+		if (tb->tokens < need) {
+			return 0;
+		}
+	}
+	tbucket_spend(tb, need);
+	return 1;
+}
+
+void tbucket_charge(stTokenBucket_t *tb, u32 n) {
+	if (tb->rate != 0) {
+		tbucket_spend(tb, (s64)n * TB_UNIT);
+	}
+}
+
+u32 tbucket_wait(stTokenBucket_t *tb) {
+	if (tb->rate == 0 || tb->tokens >= 0) {
+		return 0;
+	}
+	tbucket_refill(tb);
+	if (tb->tokens >= 0) {
+		return 0;
+	}
+	return (u32)((-tb->tokens + tb->rate - 1) / tb->rate);
+}
+
+int ratelimit_admit(stRateLimit_t *rl, stEvent_t *e) {
+	/* held events go first, nothing may overtake them */
+	if (rl->held == 0 && tbucket_take(&rl->tb, 1)) {
+		rl->passed++;
+		return 1;
+	}
+	if (rl->policy == RATE_POLICE || rl->held >= rl->qmax) {
+		rl->dropped++;
+		event_put(e);
+		return -1;
+	}
+	ilist_push_back(&rl->hold, &e->node);
+	rl->held++;
+	rl->delayed++;
+	return 0;
+}
+
+stEvent_t *ratelimit_release(stRateLimit_t *rl) {
+	if (rl->held == 0 || !tbucket_take(&rl->tb, 1)) {
+		return NULL;
+	}
+	rl->held--;
+	return ilist_entry(ilist_pop_front(&rl->hold), stEvent_t, node);
+}
+
+u32 ratelimit_retry(stRateLimit_t *rl) {
+	/* a whole token, refill granularity is 1 ms */
+	u32 ms = TB_UNIT / rl->tb.rate;
+
+	return ms > 0 ? ms : 1;
+}
+
+static void ratelimit_timeout(struct timer *timer) {
+	stRateLimit_t *rl = CONTAINER_OF(stRateLimit_t, timer, timer);
+	stEvent_t *e;
+
+	while ((e = ratelimit_release(rl)) != NULL) {
+		rl->out(e);
+	}
+	if (rl->held > 0) {
+		timer_set(rl->th, &rl->timer, ratelimit_retry(rl));
+	}
+}
+
+void ratelimit_init(stRateLimit_t *rl, struct timer_head *th,
+										u32 rate, u32 burst, int policy, int qmax,
+										int (*out)(stEvent_t *e)) {
+	memset(rl, 0, sizeof(*rl));
+	tbucket_init(&rl->tb, rate, burst);
+	rl->policy = policy;
+	rl->qmax = qmax > 0 ? qmax : RATE_QUEUE_MAX;
+	ilist_init(&rl->hold);
+	timer_init(&rl->timer, ratelimit_timeout);
+	rl->th = th;
+	rl->out = out;
+}
+
+void ratelimit_free(stRateLimit_t *rl) {
+	stEvent_t *e;
+
+	if (rl->th != NULL) {
+		timer_cancel(rl->th, &rl->timer);
+	}
+	while (rl->held > 0) {
+		e = ilist_entry(ilist_pop_front(&rl->hold), stEvent_t, node);
+		rl->held--;
+		event_put(e);
+	}
+}
+
+int ratelimit_push(stRateLimit_t *rl, stEvent_t *e) {
+	int ret = ratelimit_admit(rl, e);
+
+	if (ret > 0) {
+		return rl->out(e);
+	}
+	if (ret == 0 && !timer_active(&rl->timer)) {
+		ratelimit_timeout(&rl->timer);
+	}
+	return ret;
+}
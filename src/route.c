@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "hashmap.h"
+#include "json_parser.h"
+#include "conf_io.h"
+#include "route.h"
+#include "pipe.h"
+
+static struct hashmap routes;		/* pattern -> route */
+static stRoute_t *route_list;
+static stRoute_t *pubs[CHAN_MAX];	/* chan -> PUB route */
+static stRoute_t *subs[CHAN_MAX];	/* chan -> first SUB route */
+static int route_num;
+
+HASHMAP_FUNCS_CREATE(route, const char, stRoute_t)
+
+int route_init(void) {
+	if (hashmap_init(&routes, hashmap_hash_string, hashmap_compare_string, 0) < 0) {
+		return -1;
+	}
+	route_list = NULL;
+	memset(pubs, 0, sizeof(pubs));
+	memset(subs, 0, sizeof(subs));
+	route_num = 0;
+	return 0;
+}
+
+void route_free(void) {
+	stRoute_t *r;
+
+	hashmap_destroy(&routes);
+	while ((r = route_list) != NULL) {
+		route_list = r->next;
+		ratelimit_free(&r->rl);
+		free(r->pattern);
+		FREE(r);
+	}
+	memset(pubs, 0, sizeof(pubs));
+	memset(subs, 0, sizeof(subs));
+	route_num = 0;
+}
+
+int route_add(const char *pattern, int chan, int dir) {
+	stRoute_t *r;
+	int len;
+
+	if (pattern == NULL || (len = strlen(pattern)) == 0 ||
+			chan <= CHAN_CTRL || chan >= CHAN_MAX) {
+		log_warn("bad route %s:%d", pattern ? pattern : "", chan);
+		return -1;
+	}
+	/* a topic both subscribed and published would echo back and forth */
+	if (route_get(pattern) != NULL) {
+		log_warn("duplicate route %s", pattern);
+		return -1;
+	}
+	if (dir == ROUTE_PUB && pubs[chan] != NULL) {
+		log_warn("chan %d already published as %s", chan, pubs[chan]->pattern);
+		return -1;
+	}
+
+	r = (stRoute_t *)MALLOC(sizeof(*r));
+	if (r == NULL) {
+		return -1;
+	}
+	memset(r, 0, sizeof(*r));
+	/* strdup'ed, the pattern goes back with free() */
+	r->pattern = strdup(pattern);
+	if (r->pattern == NULL) {
+		FREE(r);
+		return -1;
+	}
+	r->wild = pattern[len - 1] == '*';
+	r->plen = r->wild ? len - 1 : len;
+	r->chan = chan;
+	r->dir = dir;
+	r->prio = EVENT_PRIO_NORMAL;
+	ratelimit_init(&r->rl, NULL, 0, 0, RATE_SHAPE, 0, NULL);
+	if (hashmap_route_put(&routes, r->pattern, r) != r) {
+		free(r->pattern);
+		FREE(r);
+		return -1;
+	}
+	r->next = route_list;
+	route_list = r;
+	if (dir == ROUTE_PUB) {
+		pubs[chan] = r;
+	} else if (subs[chan] == NULL) {
+		subs[chan] = r;
+	}
+	route_num++;
+	log_info("route %s %s chan %d", dir == ROUTE_SUB ? "sub" : "pub", pattern, chan);
+	return 0;
+}
+
+/* a level name or number, absent -> normal, -1 if invalid */
+static int route_conf_prio(json_t *v) {
+	static const char *const names[EVENT_PRIO_MAX] = EVENT_PRIO_NAMES;
+	int i;
+
+	if (v == NULL) {
+		return EVENT_PRIO_NORMAL;
+	}
+	if (json_is_integer(v)) {
+		i = json_integer_value(v);
+		return i >= 0 && i < EVENT_PRIO_MAX ? i : -1;
+	}
+	for (i = 0; json_is_string(v) && i < EVENT_PRIO_MAX; i++) {
+		if (strcmp(json_string_value(v), names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int route_conf_limit(stRoute_t *r, json_t *item) {
+	int rate = 0, burst = 0, qmax = 0, policy = RATE_SHAPE;
+	const char *s = json_get_string(item, "policy");
+
+	if (json_object_get(item, "rate") == NULL) {
+		return 0;
+	}
+	if (json_get_int(item, "rate", &rate) < 0 || rate < 0 || r->dir != ROUTE_SUB) {
+		return -1;
+	}
+	json_get_int(item, "burst", &burst);
+	json_get_int(item, "queue", &qmax);
+	if (s != NULL && strcmp(s, "police") == 0) {
+		policy = RATE_POLICE;
+	} else if (s != NULL && strcmp(s, "shape") != 0) {
+		return -1;
+	}
+	ratelimit_init(&r->rl, NULL, rate, burst, policy, qmax, NULL);
+	return 0;
+}
+
+static int route_conf_list(json_t *arr, int dir) {
+	json_t *item;
+	size_t i;
+	int chan, prio;
+	const char *pattern;
+
+	if (arr == NULL) {
+		return 0;
+	}
+	if (!json_is_array(arr)) {
+		return -1;
+	}
+	json_array_foreach(arr, i, item) {
+		pattern = json_get_string(item, "pattern");
+		prio = route_conf_prio(json_object_get(item, "prio"));
+		if (json_get_int(item, "chan", &chan) < 0 || prio < 0 ||
+				route_add(pattern, chan, dir) < 0) {
+			return -1;
+		}
+		route_get(pattern)->prio = prio;
+		if (route_conf_limit(route_get(pattern), item) < 0) {
+			log_err("bad rate limit on %s", pattern);
+			return -1;
+		}
+		if (dir == ROUTE_PUB) {
+			route_get(pattern)->batch = json_is_true(json_object_get(item, "batch"));
+		}
+	}
+	return 0;
+}
+
+static int route_conf_set(json_t *obj) {
+	if (route_conf_list(json_object_get(obj, "subscribe"), ROUTE_SUB) < 0 ||
+			route_conf_list(json_object_get(obj, "publish"), ROUTE_PUB) < 0) {
+		log_err("bad routes config");
+		return -1;
+	}
+	return 0;
+}
+
+int route_conf_load(const char *path) {
+	if (conf_init(path, NULL) < 0) {
+		return -1;
+	}
+	conf_register("routes", route_conf_set, NULL);
+	/* stages of the event pipelines, see pipe.h */
+	conf_register("pipeline", pipe_conf_set, NULL);
+	return conf_load();
+}
+
+int route_count(void) {
+	return route_num;
+}
+
+int route_register(struct ubus_context *ctx, ubus_event_handler_t cb) {
+	stRoute_t *r;
+	int ret = 0;
+
+	for (r = route_list; r != NULL; r = r->next) {
+		if (r->dir != ROUTE_SUB) {
+			continue;
+		}
+		r->handler.cb = cb;
+		if (ubus_register_event_handler(ctx, &r->handler, r->pattern) != 0) {
+			log_warn("register %s failed", r->pattern);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+void route_limit_start(struct timer_head *th, int (*out)(stEvent_t *e)) {
+	stRoute_t *r;
+
+	for (r = route_list; r != NULL; r = r->next) {
+		r->rl.th = th;
+		r->rl.out = out;
+		if (r->rl.tb.rate > 0) {
+			log_info("route %s limited to %u/s", r->pattern, r->rl.tb.rate);
+		}
+	}
+}
+
+int route_foreach(int (*func)(stRoute_t *r, void *arg), void *arg) {
+	stRoute_t *r;
+	int ret;
+
+	for (r = route_list; r != NULL; r = r->next) {
+		ret = func(r, arg);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+stRoute_t *route_get(const char *pattern) {
+	return hashmap_route_get(&routes, pattern);
+}
+
+stRoute_t *route_pub(int chan) {
+	if (chan <= CHAN_CTRL || chan >= CHAN_MAX) {
+		return NULL;
+	}
+	return pubs[chan];
+}
+
+stRoute_t *route_sub(int chan) {
+	if (chan <= CHAN_CTRL || chan >= CHAN_MAX) {
+		return NULL;
+	}
+	return subs[chan];
+}
+
+bool route_match(const stRoute_t *r, const char *topic) {
+	if (r->wild) {
+		return strncmp(r->pattern, topic, r->plen) == 0;
+	}
+	return strcmp(r->pattern, topic) == 0;
+}
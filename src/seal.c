@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "common.h"
+#include "log.h"
+#include "hex.h"
+#include "crypto.h"
+#include "seal.h"
+
+#define SEAL_KEY_MAX	32
+
+static u8 seal_key[SEAL_KEY_MAX];
+static size_t seal_key_len;
+
+int seal_key_load(const char *path) {
+	char text[2 * SEAL_KEY_MAX + 2];
+	FILE *fp = fopen(path, "rb");
+	size_t len;
+	ssize_t n;
+
+	if (fp == NULL) {
+		log_err("open key %s: %m", path);
+		return -1;
+	}
+	len = fread(text, 1, sizeof(text), fp);
+	fclose(fp);
+
+	if (len == 16 || len == 24 || len == 32) {
+		memcpy(seal_key, text, len);
+		seal_key_len = len;
+	} else {
+		/* hex, trailing newline allowed */
+		while (len > 0 && isspace((unsigned char)text[len - 1])) {
+			len--;
+		}
+		n = hex_parse_n(seal_key, sizeof(seal_key), text, len, NULL);
+		if (n != 16 && n != 24 && n != 32) {
+			log_err("key %s: want 16, 24 or 32 bytes, raw or hex", path);
+			return -1;
+		}
+		seal_key_len = n;
+	}
+	log_info("link key %s: AES-%zu-GCM", path, seal_key_len * 8);
+	return 0;
+}
+
+int seal_enabled(void) {
+	return seal_key_len > 0;
+}
+
+static const char *const seal_labels[] = {
+	[SEAL_C2S] = "c2s",
+	[SEAL_S2C] = "s2c",
+};
+
+/* the key of one direction of one connection */
+static int seal_derive(stSeal_t *s, const u8 *salt) {
+	const char *label = seal_labels[s->dir];
+	u8 key[SEAL_KEY_MAX];
+	int ret;
+
+	if (crypto_hkdf_sha256(key, seal_key_len, seal_key, seal_key_len,
+												 salt, SEAL_SALT_LEN, label, strlen(label)) < 0) {
+		return -1;
+	}
+	ret = crypto_init_aes_gcm(&s->cs, key, seal_key_len);
+	memset(key, 0, sizeof(key));
+	if (ret < 0) {
+		return -1;
+	}
+	s->keyed = 1;
+	return 0;
+}
+
+static stSeal_t *seal_new(int dir) {
+	stSeal_t *s = MALLOC(sizeof(*s));
+
+	if (s == NULL) {
+		return NULL;
+	}
+	memset(s, 0, sizeof(*s));
+	s->dir = dir;
+	return s;
+}
+
+int seal_pair(stSeal_t **tx, stSeal_t **rx, int dir) {
+	*tx = NULL;
+	*rx = NULL;
+	if (seal_key_len == 0) {
+		return -1;
+	}
+	*tx = seal_new(dir);
+	*rx = seal_new(dir == SEAL_C2S ? SEAL_S2C : SEAL_C2S);
+	if (*tx == NULL || *rx == NULL) {
+		goto error;
+	}
+	/* rx is keyed by our salt, which tx sends, tx waits for the peer's */
+	if (crypto_random((*tx)->salt, SEAL_SALT_LEN) < 0 ||
+			seal_derive(*rx, (*tx)->salt) < 0) {
+		goto error;
+	}
+	(*rx)->peer = *tx;
+	return 0;
+
+error:
+	seal_free(*tx);
+	seal_free(*rx);
+	*tx = NULL;
+	*rx = NULL;
+	return -1;
+}
+
+void seal_free(stSeal_t *s) {
+	if (s == NULL) {
+		return;
+	}
+	crypto_cleanup(&s->cs);
+	FREE(s->buf);
+	FREE(s->rbuf);
+	FREE(s);
+}
+
+static int seal_grow(char **buf, unsigned int *size, unsigned int need) {
+	char *p;
+
+	if (*size >= need) {
+		return 0;
+	}
+	/* MALLOC has no realloc, the old contents are copied over */
+	p = MALLOC(need);
+	if (p == NULL) {
+		return -1;
+	}
+	if (*buf != NULL) {
+		memcpy(p, *buf, *size);
+		FREE(*buf);
+	}
+	*buf = p;
+	*size = need;
+	return 0;
+}
+
+int seal_put(stSeal_t *s, const void *in, unsigned int len) {
+	if (s->len + len + CRYPTO_GCM_OVERHEAD > SEAL_REC_MAX) {
+		log_warn("seal batch over %u bytes", SEAL_REC_MAX);
+		return -1;
+	}
+	if (seal_grow(&s->buf, &s->size, s->len + len) < 0) {
+		return -1;
+	}
+	memcpy(s->buf + s->len, in, len);
+	s->len += len;
+	return 0;
+}
+
+int seal_record(stSeal_t *s, const void *in, unsigned int len,
+								char **out, unsigned int *olen) {
+	/* the salt goes in front of the first record */
+	unsigned int pre = s->salt_sent ? 0 : SEAL_SALT_LEN;
+	unsigned int size = pre + SEAL_REC_HDR + len + CRYPTO_GCM_OVERHEAD;
+	char *rec, *h;
+	ssize_t ret;
+
+	*out = NULL;
+	*olen = 0;
+	if (!s->keyed) {
+		log_warn("seal record before the peer's salt");
+		return -1;
+	}
+	if (len + CRYPTO_GCM_OVERHEAD > SEAL_REC_MAX) {
+		log_warn("seal record over %u bytes", SEAL_REC_MAX);
+		return -1;
+	}
+	rec = MALLOC(size);
+	if (rec == NULL) {
+		return -1;
+	}
+	h = rec + pre;
+	ret = crypto_encrypt(&s->cs, in, len, h + SEAL_REC_HDR, size - pre - SEAL_REC_HDR);
+	if (ret < 0) {
+		FREE(rec);
+		return -1;
+	}
+	memcpy(rec, s->salt, pre);
+	s->salt_sent = 1;
+	h[0] = (ret >> 24) & 0xff;
+	h[1] = (ret >> 16) & 0xff;
+	h[2] = (ret >> 8) & 0xff;
+	h[3] = ret & 0xff;
+	s->records++;
+	*out = rec;
+	*olen = pre + SEAL_REC_HDR + ret;
+	return 0;
+}
+
+/* the salt on its own, while there is nothing or nothing yet to seal */
+static int seal_salt(stSeal_t *s, char **out, unsigned int *olen) {
+	if (s->salt_sent) {
+		return 0;
+	}
+	*out = MALLOC(SEAL_SALT_LEN);
+	if (*out == NULL) {
+		return -1;
+	}
+	memcpy(*out, s->salt, SEAL_SALT_LEN);
+	*olen = SEAL_SALT_LEN;
+	s->salt_sent = 1;
+	return 0;
+}
+
+int seal_flush(stSeal_t *s, char **out, unsigned int *olen) {
+	int ret;
+
+	*out = NULL;
+	*olen = 0;
+	if (s->len == 0 || !s->keyed) {
+		return seal_salt(s, out, olen);
+	}
+	ret = seal_record(s, s->buf, s->len, out, olen);
+	s->len = 0;
+	return ret;
+}
+
+int seal_open(stSeal_t *s, const void *in, unsigned int len,
+							int (*sink)(void *arg, const void *buf, unsigned int len), void *arg) {
+	unsigned int off = 0;
+	unsigned char *h;
+	unsigned int rec;
+	ssize_t ret;
+
+	if (seal_grow(&s->rbuf, &s->rsize, s->rlen + len) < 0) {
+		return -1;
+	}
+	memcpy(s->rbuf + s->rlen, in, len);
+	s->rlen += len;
+
+	/* the peer's salt leads its stream, it keys what we send */
+	if (s->peer != NULL && !s->peer->keyed) {
+		if (s->rlen < SEAL_SALT_LEN) {
+			return 0;
+		}
+		if (seal_derive(s->peer, (u8 *)s->rbuf) < 0) {
+			return -1;
+		}
+		off = SEAL_SALT_LEN;
+	}
+
+	/* an instance only opens, buf holds the plaintext of one record */
+	while (s->rlen - off >= SEAL_REC_HDR) {
+		h = (unsigned char *)s->rbuf + off;
+		rec = ((unsigned int)h[0] << 24) | (h[1] << 16) | (h[2] << 8) | h[3];
+		if (rec < CRYPTO_GCM_OVERHEAD || rec > SEAL_REC_MAX) {
+			log_warn("seal record length %u", rec);
+			s->failed++;
+			return -1;
+		}
+		if (s->rlen - off < SEAL_REC_HDR + rec) {
+			break;
+		}
+		if (seal_grow(&s->buf, &s->size, rec) < 0) {
+			return -1;
+		}
+		ret = crypto_decrypt(&s->cs, s->rbuf + off + SEAL_REC_HDR, rec, s->buf, s->size);
+		if (ret < 0) {
+			s->failed++;
+			return -1;
+		}
+		off += SEAL_REC_HDR + rec;
+		s->records++;
+		if (sink(arg, s->buf, ret) < 0) {
+			return -1;
+		}
+	}
+	if (off > 0) {
+		memmove(s->rbuf, s->rbuf + off, s->rlen - off);
+		s->rlen -= off;
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <string.h>
+
+#include "common.h"
+#include "timer.h"
+#include "stats.h"
+#include "route.h"
+
+#include <libubox/blobmsg.h>
+
+stStats_t stats;
+
+static const char *stats_dirs[STATS_DIRS] = {
+	[STATS_UP] = "up",
+	[STATS_DOWN] = "down",
+};
+
+static void stats_tick(struct timer *timer) {
+	int c, d;
+
+	for (c = 0; c < CHAN_MAX; c++) {
+		for (d = 0; d < STATS_DIRS; d++) {
+			stStatsDir_t *sd = &stats.chan[c][d];
+			sd->msg_rate = sd->out_msgs - sd->last_msgs;
+			sd->byte_rate = sd->out_bytes - sd->last_bytes;
+			sd->last_msgs = sd->out_msgs;
+			sd->last_bytes = sd->out_bytes;
+		}
+	}
+	timer_set(stats.th, &stats.timer, STATS_RATE_MS);
+}
+
+void stats_init(struct timer_head *th) {
+	memset(&stats, 0, sizeof(stats));
+	stats.th = th;
+	timer_init(&stats.timer, stats_tick);
+	timer_set(th, &stats.timer, STATS_RATE_MS);
+}
+
+/* upper bound in us of the bucket holding the pct-th percentile */
+u32 stats_percentile(int dir, int pct) {
+	u64 total = 0;
+	u64 seen = 0;
+	int b;
+
+	for (b = 0; b < STATS_LAT_BUCKETS; b++) {
+		total += stats.lat[dir][b];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	for (b = 0; b < STATS_LAT_BUCKETS; b++) {
+		seen += stats.lat[dir][b];
+		if (seen * 100 >= total * pct) {
+			break;
+		}
+	}
+	return b ? 1u << b : 0;
+}
+
+void stats_dump(struct blob_buf *b) {
+	void *arr;
+	void *tbl;
+	void *dtbl;
+	int c, d;
+
+	arr = blobmsg_open_array(b, "channels");
+	for (c = 0; c < CHAN_MAX; c++) {
+		stRoute_t *sub = route_sub(c);
+		stRoute_t *pub = route_pub(c);
+		if (sub == NULL && pub == NULL && stats.chan[c][STATS_UP].in_msgs == 0 &&
+				stats.chan[c][STATS_DOWN].in_msgs == 0) {
+			continue;
+		}
+		tbl = blobmsg_open_table(b, NULL);
+		blobmsg_add_u32(b, "chan", c);
+		if (sub != NULL) {
+			blobmsg_add_string(b, "subscribe", sub->pattern);
+		}
+		if (pub != NULL) {
+			blobmsg_add_string(b, "publish", pub->pattern);
+		}
+		for (d = 0; d < STATS_DIRS; d++) {
+			stStatsDir_t *sd = &stats.chan[c][d];
+			dtbl = blobmsg_open_table(b, stats_dirs[d]);
+			blobmsg_add_u64(b, "in_msgs", sd->in_msgs);
+			blobmsg_add_u64(b, "in_bytes", sd->in_bytes);
+			blobmsg_add_u64(b, "out_msgs", sd->out_msgs);
+			blobmsg_add_u64(b, "out_bytes", sd->out_bytes);
+			blobmsg_add_u64(b, "drops", sd->drops);
+			blobmsg_add_u32(b, "msgs_per_s", sd->msg_rate);
+			blobmsg_add_u32(b, "bytes_per_s", sd->byte_rate);
+			blobmsg_close_table(b, dtbl);
+		}
+		blobmsg_close_table(b, tbl);
+	}
+	blobmsg_close_array(b, arr);
+
+	tbl = blobmsg_open_table(b, "latency_us");
+	for (d = 0; d < STATS_DIRS; d++) {
+		dtbl = blobmsg_open_table(b, stats_dirs[d]);
+		blobmsg_add_u32(b, "p50", stats_percentile(d, 50));
+		blobmsg_add_u32(b, "p90", stats_percentile(d, 90));
+		blobmsg_add_u32(b, "p99", stats_percentile(d, 99));
+		blobmsg_close_table(b, dtbl);
+	}
+	blobmsg_close_table(b, tbl);
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "route.h"
+#include "stats.h"
+#include "pool.h"
+#include "ubus_link.h"
+#include "stats_dump.h"
+
+#include <libubox/blobmsg.h>
+
+static int ubus_stats(struct ubus_context *ctx, struct ubus_object *obj,
+											struct ubus_request_data *req, const char *method,
+											struct blob_attr *msg);
+static int ubus_clients(struct ubus_context *ctx, struct ubus_object *obj,
+												struct ubus_request_data *req, const char *method,
+												struct blob_attr *msg);
+static int ubus_queues(struct ubus_context *ctx, struct ubus_object *obj,
+											 struct ubus_request_data *req, const char *method,
+											 struct blob_attr *msg);
+
+static const struct ubus_method ubus_methods[] = {
+	UBUS_METHOD_NOARG("stats", ubus_stats),
+	UBUS_METHOD_NOARG("clients", ubus_clients),
+	UBUS_METHOD_NOARG("queues", ubus_queues),
+};
+
+static struct ubus_object_type ubus_obj_type = UBUS_OBJECT_TYPE("ubus2net", ubus_methods);
+
+static struct ubus_object ubus_obj = {
+	.name = "ubus2net",
+	.type = &ubus_obj_type,
+	.methods = ubus_methods,
+	.n_methods = sizeof(ubus_methods)/sizeof(ubus_methods[0]),
+};
+
+static const stStatsDump_t *dump;
+static struct blob_buf sb;
+
+static int ubus_limit_dump(stRoute_t *r, void *arg) {
+	void *tbl;
+	if (r->rl.tb.rate == 0) {
+		return 0;
+	}
+	tbl = blobmsg_open_table(&sb, NULL);
+	blobmsg_add_string(&sb, "pattern", r->pattern);
+	blobmsg_add_u32(&sb, "rate", r->rl.tb.rate);
+	blobmsg_add_string(&sb, "policy", r->rl.policy == RATE_POLICE ? "police" : "shape");
+	blobmsg_add_u32(&sb, "passed", r->rl.passed);
+	blobmsg_add_u32(&sb, "delayed", r->rl.delayed);
+	blobmsg_add_u32(&sb, "dropped", r->rl.dropped);
+	blobmsg_add_u32(&sb, "held", r->rl.held);
+	blobmsg_close_table(&sb, tbl);
+	return 0;
+}
+
+static void ubus_mem_dump(void) {
+	stMemSite_t sites[MEM_SITE_MAX];
+	stMemStats_t st;
+	void *tbl, *arr, *t;
+	char name[128];
+	int i, n;
+
+	mem_stats(&st);
+	tbl = blobmsg_open_table(&sb, "mem");
+	blobmsg_add_string(&sb, "allocator", st.name);
+	blobmsg_add_u64(&sb, "allocs", st.allocs);
+	blobmsg_add_u64(&sb, "frees", st.frees);
+	blobmsg_add_u64(&sb, "bytes", st.bytes);
+	blobmsg_add_u64(&sb, "peak", st.peak);
+	n = mem_sites(sites, MEM_SITE_MAX);
+	arr = blobmsg_open_array(&sb, "sites");
+	for (i = 0; i < n; i++) {
+		t = blobmsg_open_table(&sb, NULL);
+		snprintf(name, sizeof(name), "%s:%d", sites[i].file, sites[i].line);
+		blobmsg_add_string(&sb, "site", name);
+		blobmsg_add_u32(&sb, "allocs", sites[i].allocs);
+		blobmsg_add_u32(&sb, "live", sites[i].live);
+		blobmsg_add_u64(&sb, "bytes", sites[i].bytes);
+		blobmsg_add_u64(&sb, "peak", sites[i].peak);
+		blobmsg_close_table(&sb, t);
+	}
+	blobmsg_close_array(&sb, arr);
+	blobmsg_close_table(&sb, tbl);
+}
+
+static void ubus_pool_dump(void) {
+	stPoolStats_t st[POOL_NCLASS + 1];
+	int i, n = pool_stats(st, POOL_NCLASS + 1);
+	void *arr, *tbl;
+
+	arr = blobmsg_open_array(&sb, "pool");
+	for (i = 0; i < n; i++) {
+		tbl = blobmsg_open_table(&sb, NULL);
+		blobmsg_add_u32(&sb, "size", st[i].size);
+		blobmsg_add_u64(&sb, "allocs", st[i].allocs);
+		blobmsg_add_u32(&sb, "hit_pct", st[i].allocs > 0 ? (u32)(st[i].hits * 100 / st[i].allocs) : 0);
+		blobmsg_add_u32(&sb, "in_use", st[i].in_use);
+		blobmsg_add_u32(&sb, "high", st[i].high);
+		blobmsg_add_u32(&sb, "slabs", st[i].slabs);
+		blobmsg_close_table(&sb, tbl);
+	}
+	blobmsg_close_array(&sb, arr);
+}
+
+static void ubus_pipe_dump(stPipe_t *p) {
+	stPipeStage_t *s;
+	void *arr, *tbl;
+
+	arr = blobmsg_open_array(&sb, p->name);
+	for (s = p->head; s != NULL; s = s->next) {
+		tbl = blobmsg_open_table(&sb, NULL);
+		blobmsg_add_string(&sb, "stage", s->ops->name);
+		blobmsg_add_u64(&sb, "in", s->in);
+		blobmsg_add_u64(&sb, "out", s->out);
+		blobmsg_add_u64(&sb, "dropped", s->dropped);
+		blobmsg_close_table(&sb, tbl);
+	}
+	blobmsg_close_array(&sb, arr);
+}
+
+static int ubus_stats(struct ubus_context *ctx, struct ubus_object *obj,
+											struct ubus_request_data *req, const char *method,
+											struct blob_attr *msg) {
+	void *tbl;
+	blob_buf_init(&sb, 0);
+	stats_dump(&sb);
+	tbl = blobmsg_open_table(&sb, "dedup");
+	blobmsg_add_u32(&sb, "window_ms", ue.dedup.window);
+	blobmsg_add_u32(&sb, "entries", ue.dedup.count);
+	blobmsg_add_u32(&sb, "hits", ue.dedup.hits);
+	blobmsg_add_u32(&sb, "misses", ue.dedup.misses);
+	blobmsg_close_table(&sb, tbl);
+	tbl = blobmsg_open_array(&sb, "limits");
+	route_foreach(ubus_limit_dump, NULL);
+	blobmsg_close_array(&sb, tbl);
+	ubus_mem_dump();
+	ubus_pool_dump();
+	tbl = blobmsg_open_table(&sb, "pipes");
+	ubus_pipe_dump(dump->up);
+	ubus_pipe_dump(dump->down);
+	blobmsg_close_table(&sb, tbl);
+	return ubus_send_reply(ctx, req, sb.head);
+}
+
+static void ubus_queue_dump(const char *name, stChanQueue_t *cq) {
+	static const char *const prios[EVENT_PRIO_MAX] = EVENT_PRIO_NAMES;
+	void *tbl = blobmsg_open_table(&sb, name);
+	int c;
+	blobmsg_add_u32(&sb, "size", chanq_size(cq));
+	for (c = 0; c < EVENT_PRIO_MAX; c++) {
+		blobmsg_add_u32(&sb, prios[c], chanq_level_size(cq, c));
+	}
+	for (c = 0; c < CHAN_MAX; c++) {
+		if (chanq_depth(cq, c) > 0) {
+			char key[16];
+			snprintf(key, sizeof(key), "chan%d", c);
+			blobmsg_add_u32(&sb, key, chanq_depth(cq, c));
+		}
+	}
+	blobmsg_close_table(&sb, tbl);
+}
+
+static int ubus_queues(struct ubus_context *ctx, struct ubus_object *obj,
+											 struct ubus_request_data *req, const char *method,
+											 struct blob_attr *msg) {
+	blob_buf_init(&sb, 0);
+	ubus_queue_dump("ubus", &ue.eq);
+	ubus_queue_dump("link", dump->link);
+	blobmsg_add_u32(&sb, "batched", ubus_batched());
+	if (dump->queues != NULL) {
+		dump->queues(&sb);
+	}
+	return ubus_send_reply(ctx, req, sb.head);
+}
+
+void stats_dump_codec(struct blob_buf *b, stCodec_t *tx, stCodec_t *rx, stSeal_t *seal) {
+	blobmsg_add_u8(b, "sealed", seal != NULL);
+	if (seal != NULL) {
+		blobmsg_add_u64(b, "rx_records", seal->records);
+	}
+	blobmsg_add_string(b, "codec", tx != NULL ? tx->ops->name : "none");
+	if (tx != NULL) {
+		blobmsg_add_u64(b, "tx_raw", tx->raw);
+		blobmsg_add_u64(b, "tx_wire", tx->wire);
+	}
+	if (rx != NULL) {
+		blobmsg_add_u64(b, "rx_wire", rx->wire);
+		blobmsg_add_u64(b, "rx_raw", rx->raw);
+	}
+}
+
+void stats_dump_rx(struct blob_buf *b, const struct queue_buf *qb,
+									 const struct queue_buf_pool *pool) {
+	const struct queue_buf_stats *st = queue_buf_stats(qb);
+
+	blobmsg_add_u32(b, "rx_bytes", queue_buf_len(qb));
+	blobmsg_add_u64(b, "rx_segs", st->allocs);
+	blobmsg_add_u64(b, "rx_pool_hits", st->pool_hits);
+	blobmsg_add_u64(b, "rx_shared", st->shared);
+	blobmsg_add_u32(b, "rx_pool_in_use", pool->in_use);
+	blobmsg_add_u32(b, "rx_pool_high", pool->high);
+}
+
+static int ubus_clients(struct ubus_context *ctx, struct ubus_object *obj,
+												struct ubus_request_data *req, const char *method,
+												struct blob_attr *msg) {
+	void *arr;
+	blob_buf_init(&sb, 0);
+	arr = blobmsg_open_array(&sb, "clients");
+	dump->clients(&sb);
+	blobmsg_close_array(&sb, arr);
+	return ubus_send_reply(ctx, req, sb.head);
+}
+
+int stats_dump_init(struct ubus_context *ctx, const stStatsDump_t *sd) {
+	dump = sd;
+	if (ubus_add_object(ctx, &ubus_obj) != 0) {
+		log_warn("add ubus object %s failed", ubus_obj.name);
+		return -1;
+	}
+	return 0;
+}
@@ -14,6 +14,7 @@
  * @revision:
  *  - 1.0 2015/06/15 by au.
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -21,11 +22,30 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <fcntl.h>
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
+#include "utypes.h"
+#include "common.h"
+#include "buffer.h"
 #include "tcp.h"
+#include "codec.h"
+#include "seal.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY						60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY					0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY	5
+#endif
 
 int tcp_init(int type, const char *ip, int port) {
 	int 				reuse = 1;
@@ -86,66 +106,62 @@ int tcp_free(int fd) {
 		int ret = recv(fd, buf, sizeof(buf), 0);
 		if (ret == 0)  break;
 		if (ret == -1) {	
-			if (errno == EAGAIN) break;
-			if (errno == EWOULDBLOCK) break;
-			if (errno == 9) break;
+			if (errno == EINTR) continue;
+			break; //EAGAIN on non-blocking sockets, ENOTCONN after a failed connect
 		}
 	} while (1);
 	close(fd);
 	fd = -1;
 	return 0;
 }
+/* poll() has no FD_SETSIZE limit, 1 -> ready, 0 -> timeout */
+static int tcp_wait(int fd, short events, int _s, int _u) {
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+wait_tag:
+	ret = poll(&pfd, 1, _s * 1000 + _u / 1000);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR) {
+			goto wait_tag;
+		}
+		return -2;
+	} else if (ret == 0) {
+		return 0;
+	} else if (!(pfd.revents & (events | POLLERR | POLLHUP))) {
+		return -5;
+	}
+	return 1;
+}
 int tcp_recv(int fd, char *_buf, unsigned int _size, int _s, int _u) {
-	fd_set	fds;
-	struct timeval	tv;
 	int ret;
 	int en;
-	char es[256];
 
 	if (_buf == NULL || _size <= 0 || _s < 0 || _u < 0 || fd <= 0)  {
 		return -1;
 	}
-recv_select_tag:
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-	tv.tv_sec = _s;
-	tv.tv_usec = _u;
-	ret = select(fd + 1, &fds, NULL, NULL, &tv);
+	ret = tcp_wait(fd, POLLIN, _s, _u);
+	if (ret <= 0) {
+		return ret;
+	}
+recv_tag:
+	ret = recv(fd, _buf, _size, 0);
 	if (ret < 0) {
 		en = errno;
 		if (en == EAGAIN || en == EINTR) {
-			goto recv_select_tag;
+			goto recv_tag;
 		} else {
-			strerror_r(en, es, sizeof(es));
-			return -2;
+			return -3;
 		}
 	} else if (ret == 0) {
-		return 0;
-	} else if (FD_ISSET(fd, &fds)) {
-recv_tag:
-		ret = recv(fd, _buf, _size, 0);
-		if (ret < 0) {
-			en = errno;
-			if (en == EAGAIN || en == EINTR) {
-				goto recv_tag;
-			} else {
-				return -3;
-			}
-		} else {
-			if (ret == 0) {
-				return -4; //remote close the socket
-			} else {
-				;
-			}
-		}
-	} else {
-		return -5;
+		return -4; //remote close the socket
 	}
 	return ret;
 }
 int tcp_send(int fd, char *_buf, unsigned int _size, int _s, int _u) {
-	fd_set	fds;
-	struct timeval tv;
 	int ret;
 	int en;
 	int try_count = 5;
@@ -153,86 +169,532 @@ int tcp_send(int fd, char *_buf, unsigned int _size, int _s, int _u) {
 	if (_buf == NULL || _size <= 0 || _s < 0 || _u < 0 || fd <= 0)  {
 		return -1;
 	}
-
-send_select_tag:
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-	tv.tv_sec = _s;
-	tv.tv_usec = _u;
-	ret = select(fd + 1, NULL, &fds, NULL, &tv);
+	ret = tcp_wait(fd, POLLOUT, _s, _u);
+	if (ret <= 0) {
+		return ret;
+	}
+send_tag:
+	ret = send(fd, _buf, _size, 0);
 	if (ret < 0) {
 		en = errno;
-		if (en == EAGAIN || en == EINTR) {
-			goto send_select_tag;
-		} else {
-			return -2;
-		}
-	} else if (ret == 0) {
-		return 0;
-	} else if (FD_ISSET(fd, &fds)) {
-send_tag:
-		ret = send(fd, _buf, _size, 0);
-		if (ret < 0) {
-			en = errno;
-			if ((en == EAGAIN || en == EINTR) && (try_count-- >= 0)) {
-				usleep(10);
-				goto send_tag;
-			} else {
-				return -3;
-			}
-		} else if (ret != (int)_size) {
-			return -4;
+		if ((en == EAGAIN || en == EINTR) && (try_count-- >= 0)) {
+			usleep(10);
+			goto send_tag;
 		} else {
-			;
+			return -3;
 		}
-	} else {
-		return -5;
+	} else if (ret != (int)_size) {
+		return -4;
 	}
 	return ret;
 
 }
 int tcp_accept(int fd, int _s, int _u) {
-	fd_set	fds;
-	struct timeval	tv;
 	int ret;
 	struct sockaddr_in sa;
 	socklen_t		sl = sizeof(sa);
 	int en;
 
-accept_select_tag:
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
-	tv.tv_sec = _s;
-	tv.tv_usec = _u;
-
-	ret = select(fd + 1, &fds, NULL, NULL, &tv);
+	ret = tcp_wait(fd, POLLIN, _s, _u);
+	if (ret < 0) {
+		return -1;
+	} else if (ret == 0) {
+		return 0;
+	}
+accept_tag:
+	ret = accept(fd, (struct sockaddr *)&sa, &sl);
 	if (ret < 0) {
 		en = errno;
 		if (en == EAGAIN || en == EINTR) {
-			goto accept_select_tag;
+			goto accept_tag;
 		} else {
-			return -1;
+			return -2;
 		}
-	} else if (ret == 0) {
+	}
+	return ret;
+
+}
+
+int tcp_nonblock(int fd) {
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+int tcp_connect_nb(const char *ip, int port) {
+	struct sockaddr_in sa;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	sa.sin_family = AF_INET;
+	sa.sin_port   = htons((short)port);
+	inet_aton(ip, &(sa.sin_addr));
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return -2;
+	}
+	return fd;
+}
+
+int tcp_connect_done(int fd) {
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+		return -1;
+	}
+	if (err == EINPROGRESS || err == EALREADY) {
 		return 0;
-	} else if (FD_ISSET(fd, &fds)) {
+	}
+	if (err != 0) {
+		errno = err;
+		return -2;
+	}
+	return 1;
+}
+
+int tcp_recv_nb(int fd, char *_buf, unsigned int _size) {
+	int ret;
+
+	if (_buf == NULL || _size <= 0 || fd <= 0)  {
+		return -1;
+	}
+recv_tag:
+	ret = recv(fd, _buf, _size, MSG_DONTWAIT);
+	if (ret < 0) {
+		if (errno == EINTR) {
+			goto recv_tag;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		return -3;
+	} else if (ret == 0) {
+		return -4; //remote close the socket
+	}
+	return ret;
+}
+
+int tcp_send_nb(int fd, char *_buf, unsigned int _size) {
+	int ret;
+
+	if (_buf == NULL || _size <= 0 || fd <= 0)  {
+		return -1;
+	}
+send_tag:
+	ret = send(fd, _buf, _size, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0) {
+		if (errno == EINTR) {
+			goto send_tag;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		return -3;
+	}
+	return ret;
+}
+
+int tcp_accept_nb(int fd) {
+	struct sockaddr_in sa;
+	socklen_t sl = sizeof(sa);
+	int ret;
+
+	if (fd <= 0) {
+		return -1;
+	}
 accept_tag:
-		ret = accept(fd, (struct sockaddr *)&sa, &sl);
+	ret = accept4(fd, (struct sockaddr *)&sa, &sl, SOCK_NONBLOCK);
+	if (ret < 0) {
+		if (errno == EINTR) {
+			goto accept_tag;
+		}
+		/* the peer may have gone away between poll and accept */
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
+			return 0;
+		}
+		return -2;
+	}
+	return ret;
+}
+
+int tcp_readv(int fd, struct queue_buf *qb, unsigned int _size) {
+	int ret;
+
+	if (qb == NULL || _size <= 0 || fd <= 0)  {
+		return -1;
+	}
+	ret = queue_buf_readv(fd, qb, _size);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		return -3;
+	} else if (ret == 0) {
+		return -4; //remote close the socket
+	}
+	return ret;
+}
+
+int tcp_zc_init(stTcpZc_t *zc, int fd) {
+	int on = 1;
+
+	memset(zc, 0, sizeof(*zc));
+	zc->fd = fd;
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+		zc->enable = 1;
+	}
+	return zc->enable;
+}
+
+/* registered with the first id, before any completion can arrive */
+static void tcp_zc_track(stTcpZc_t *zc, stTcpZcPend_t *p) {
+	p->id = zc->id;
+	p->count = 0;
+	p->left = 0;
+	p->busy = 1;
+	p->next = NULL;
+	if (zc->tail != NULL) {
+		zc->tail->next = p;
+	} else {
+		zc->head = p;
+	}
+	zc->tail = p;
+	zc->pending++;
+}
+
+/* how many of the ids of p fall in [lo, hi] */
+static unsigned int tcp_zc_overlap(stTcpZcPend_t *p, unsigned int lo, unsigned int hi) {
+	int a = (int)(lo - p->id);
+	int z = (int)(hi - p->id);
+
+	if (a < 0) {
+		a = 0;
+	}
+	if (z > (int)p->count - 1) {
+		z = (int)p->count - 1;
+	}
+	return z >= a ? z - a + 1 : 0;
+}
+
+/* free the buffers that are written and no longer referenced */
+static void tcp_zc_sweep(stTcpZc_t *zc) {
+	stTcpZcPend_t **pp = &zc->head;
+	stTcpZcPend_t *p;
+	stTcpZcPend_t *prev = NULL;
+
+	while ((p = *pp) != NULL) {
+		if (p->left > 0 || p->busy) {
+			prev = p;
+			pp = &p->next;
+			continue;
+		}
+		*pp = p->next;
+		if (zc->tail == p) {
+			zc->tail = prev;
+		}
+		zc->pending--;
+		if (p->release != NULL) {
+			p->release(p->arg);
+		}
+		FREE(p);
+	}
+}
+
+/* ids [lo, hi] completed */
+static void tcp_zc_release(stTcpZc_t *zc, unsigned int lo, unsigned int hi) {
+	stTcpZcPend_t *p;
+	unsigned int n;
+
+	for (p = zc->head; p != NULL; p = p->next) {
+		n = tcp_zc_overlap(p, lo, hi);
+		p->left = n < p->left ? p->left - n : 0;
+	}
+	tcp_zc_sweep(zc);
+}
+
+int tcp_zc_complete(stTcpZc_t *zc) {
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	char control[128];
+	int count = 0;
+	int ret;
+
+	if (zc == NULL || zc->fd <= 0) {
+		return -1;
+	}
+	/* drain even with nothing pending, a stale completion keeps POLLERR up */
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		ret = recvmsg(zc->fd, &msg, MSG_ERRQUEUE);
 		if (ret < 0) {
-			en = errno;
-			if (en == EAGAIN || en == EINTR) {
-				goto accept_tag;
-			} else {
-				return -2;
+			if (errno == EINTR) {
+				continue;
 			}
-		} else{
-			;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -2;
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+						(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+				return -3;
+			}
+			/* ids [ee_info, ee_data] are no longer referenced by the kernel */
+			tcp_zc_release(zc, serr->ee_info, serr->ee_data);
+			count++;
+		}
+	}
+	return count;
+}
+
+void tcp_zc_free(stTcpZc_t *zc) {
+	stTcpZcPend_t *p;
+
+	if (zc == NULL) {
+		return;
+	}
+	while ((p = zc->head) != NULL) {
+		zc->head = p->next;
+		if (p->release != NULL) {
+			p->release(p->arg);
+		}
+		FREE(p);
+	}
+	zc->tail = NULL;
+	zc->pending = 0;
+	zc->enable = 0;
+	zc->fd = -1;
+}
+
+int tcp_out_init(stTcpOut_t *out, int fd) {
+	memset(out, 0, sizeof(*out));
+	tcp_zc_init(&out->zc, fd);
+	return 0;
+}
+
+static int tcp_out_write(stTcpOut_t *out, stTcpOutBuf_t *b) {
+	struct msghdr msg;
+	struct iovec iov;
+	unsigned int left = b->size - b->off;
+	int ret;
+
+	if (!out->zc.enable || left < TCP_ZC_THRESHOLD) {
+		return tcp_send_nb(out->zc.fd, b->buf + b->off, left);
+	}
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = b->buf + b->off;
+	iov.iov_len = left;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+zc_send_tag:
+	ret = sendmsg(out->zc.fd, &msg, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0) {
+		if (errno == EINTR) {
+			goto zc_send_tag;
+		}
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		if (errno == ENOBUFS) {
+			/* optmem limit reached, fall back to a copy */
+			return tcp_send_nb(out->zc.fd, b->buf + b->off, left);
 		}
-	} else {
 		return -3;
 	}
+	/* the buffer stays pinned until the completions for all its ids arrive */
+	if (!b->zc) {
+		b->zc = 1;
+		tcp_zc_track(&out->zc, &b->pend);
+	}
+	b->pend.count++;
+	b->pend.left++;
+	out->zc.id++;
 	return ret;
+}
+
+static int tcp_out_queue(stTcpOut_t *out, char *_buf, unsigned int _size,
+												 void (*release)(void *), void *arg) {
+	stTcpOutBuf_t *b;
 
+	b = (stTcpOutBuf_t *)MALLOC(sizeof(*b));
+	if (b == NULL) {
+		return -1;
+	}
+	memset(b, 0, sizeof(*b));
+	b->buf = _buf;
+	b->size = _size;
+	b->pend.release = release;
+	b->pend.arg = arg;
+	if (out->tail != NULL) {
+		out->tail->next = b;
+	} else {
+		out->head = b;
+	}
+	out->tail = b;
+	out->count++;
+	out->bytes += _size;
+	return 0;
+}
+
+static int tcp_out_queue_own(stTcpOut_t *out, char *_buf, unsigned int _size) {
+	if (_buf == NULL) {
+		return 0;
+	}
+	if (tcp_out_queue(out, _buf, _size, mem_free, _buf) < 0) {
+		FREE(_buf);
+		return -1;
+	}
+	return 0;
+}
+
+/* close the codec and seal batches, they go behind what is queued */
+static int tcp_out_batch(stTcpOut_t *out) {
+	char *buf, *rec;
+	unsigned int len;
+	int ret;
+
+	/* plaintext sent before a codec was attached goes first */
+	if (out->seal != NULL) {
+		if (seal_flush(out->seal, &buf, &len) < 0 ||
+				tcp_out_queue_own(out, buf, len) < 0) {
+			return -1;
+		}
+	}
+	if (out->codec != NULL && out->codec->pending > 0) {
+		if (codec_flush(out->codec, &buf, &len) < 0) {
+			return -1;
+		}
+		if (buf != NULL && out->seal != NULL) {
+			ret = seal_record(out->seal, buf, len, &rec, &len);
+			FREE(buf);
+			if (ret < 0) {
+				return -1;
+			}
+			buf = rec;
+		}
+		if (tcp_out_queue_own(out, buf, len) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static unsigned int tcp_out_pending(stTcpOut_t *out) {
+	return (out->codec != NULL ? out->codec->pending : 0) +
+		(out->seal != NULL ? out->seal->len : 0);
+}
+
+unsigned int tcp_out_backlog(stTcpOut_t *out) {
+	return out->bytes + tcp_out_pending(out);
 }
 
+int tcp_out_flush(stTcpOut_t *out) {
+	stTcpOutBuf_t *b;
+	int ret;
+
+	if (tcp_out_batch(out) < 0) {
+		return -1;
+	}
+	while ((b = out->head) != NULL) {
+		ret = tcp_out_write(out, b);
+		if (ret < 0) {
+			return ret;
+		}
+		b->off += ret;
+		out->bytes -= ret;
+		if (b->off < b->size) {
+			break; //socket buffer full, wait for POLLOUT
+		}
+		out->head = b->next;
+		if (out->head == NULL) {
+			out->tail = NULL;
+		}
+		out->count--;
+		if (b->zc) {
+			/* on the zerocopy list since the first send, freed there */
+			b->pend.busy = 0;
+			if (b->pend.left == 0) {
+				tcp_zc_sweep(&out->zc);
+			}
+			continue;
+		}
+		if (b->pend.release != NULL) {
+			b->pend.release(b->pend.arg);
+		}
+		FREE(b);
+	}
+	return out->bytes;
+}
+
+int tcp_out_send(stTcpOut_t *out, char *_buf, unsigned int _size,
+								 void (*release)(void *), void *arg) {
+	int ret;
 
+	if (_buf == NULL || _size <= 0 || out->zc.fd <= 0) {
+		goto release_tag;
+	}
+	if (out->codec != NULL || out->seal != NULL) {
+		/* copied into the batch, written by the next flush (POLLOUT) */
+		if (out->codec != NULL) {
+			ret = codec_encode(out->codec, _buf, _size);
+		} else {
+			ret = seal_put(out->seal, _buf, _size);
+		}
+		if (release != NULL) {
+			release(arg);
+		}
+		return ret < 0 ? -1 : (int)tcp_out_backlog(out);
+	}
+	if (tcp_out_queue(out, _buf, _size, release, arg) < 0) {
+		goto release_tag;
+	}
+	if (out->count > 1) {
+		return out->bytes; //keep order behind the backlog
+	}
+	return tcp_out_flush(out);
+
+release_tag:
+	if (release != NULL) {
+		release(arg);
+	}
+	return -1;
+}
+
+void tcp_out_free(stTcpOut_t *out) {
+	stTcpOutBuf_t *b;
+
+	while ((b = out->head) != NULL) {
+		out->head = b->next;
+		if (b->zc) {
+			continue;	//on the zerocopy list, released by tcp_zc_free
+		}
+		if (b->pend.release != NULL) {
+			b->pend.release(b->pend.arg);
+		}
+		FREE(b);
+	}
+	out->tail = NULL;
+	out->count = 0;
+	out->bytes = 0;
+	codec_free(out->codec);
+	out->codec = NULL;
+	seal_free(out->seal);
+	out->seal = NULL;
+	tcp_zc_free(&out->zc);
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "timer.h"
+#include "file_event.h"
+#include "route.h"
+#include "stats.h"
+#include "ubus_link.h"
+
+#include <libubox/blobmsg_json.h>
+
+stUbusEnv_t ue;
+static struct blob_buf b;
+
+static void receive_ubus_event(struct ubus_context *ctx, struct ubus_event_handler *ev,
+			  const char *type, struct blob_attr *msg);
+static void ubus_run(struct timer *timer);
+static void ubus_in(void *arg, int fd);
+static void ubus_batch_timeout(struct timer *timer);
+
+int ubus_init(void *_th, void *_fet, int dedup_window, int (*up)(stEvent_t *e)) {
+	ue.th = _th;
+	ue.fet = _fet;
+
+	timer_init(&ue.step_timer, ubus_run);
+
+	ue.ubus_ctx = ubus_connect(NULL);
+	route_register(ue.ubus_ctx, receive_ubus_event);
+	route_limit_start(ue.th, up);
+	stats_init(ue.th);
+	dedup_init(&ue.dedup, ue.th, dedup_window);
+
+	file_event_reg(ue.fet, ue.ubus_ctx->sock.fd, ubus_in, NULL, NULL);
+
+	chanq_init(&ue.eq, UBUS_QUANTUM);
+	int i;
+	for (i = 0; i < CHAN_MAX; i++) {
+		timer_init(&ue.batch[i].timer, ubus_batch_timeout);
+	}
+
+	return 0;
+}
+
+static int ubus_step() {
+	timer_cancel(ue.th, &ue.step_timer);
+	timer_set(ue.th, &ue.step_timer, 10);
+	return 0;
+}
+
+int ubus_push(stEvent_t *e) {
+	stRoute_t *r = route_pub(e->chan);
+	if (r != NULL) {
+		e->prio = r->prio;
+	}
+	chanq_push(&ue.eq, e);
+	ubus_step();
+	return 0;
+}
+
+int ubus_batched(void) {
+	int c, n = 0;
+	for (c = 0; c < CHAN_MAX; c++) {
+		n += ue.batch[c].count;
+	}
+	return n;
+}
+
+static void ubus_batch_flush(stUbusBatch_t *bb) {
+	if (bb->count == 0) {
+		return;
+	}
+	timer_cancel(ue.th, &bb->timer);
+	blobmsg_close_array(&bb->b, bb->cookie);
+	log_debug("ubus send %s: %d PKTS", bb->topic, bb->count);
+	ubus_send_event(ue.ubus_ctx, bb->topic, bb->b.head);
+	bb->count = 0;
+	bb->bytes = 0;
+}
+
+static void ubus_batch_timeout(struct timer *timer) {
+	ubus_batch_flush(CONTAINER_OF(stUbusBatch_t, timer, timer));
+}
+
+/* returns 0 if the PKT was batched, -1 if the caller has to send it */
+static int ubus_batch_add(int chan, const char *topic, const char *pkt) {
+	stUbusBatch_t *bb = &ue.batch[chan];
+	int len = strlen(pkt) + 1;
+
+	if (strlen(topic) >= sizeof(bb->topic)) {
+		return -1;
+	}
+	/* a wildcard route may change topic, batches never mix topics */
+	if (bb->count > 0 && (strcmp(bb->topic, topic) != 0 ||
+				bb->bytes + len > UBUS_BATCH_BYTES)) {
+		ubus_batch_flush(bb);
+	}
+	if (bb->count == 0) {
+		blob_buf_init(&bb->b, 0);
+		bb->cookie = blobmsg_open_array(&bb->b, "PKTS");
+		strcpy(bb->topic, topic);
+		timer_set(ue.th, &bb->timer, UBUS_BATCH_MS);
+	}
+	blobmsg_add_string(&bb->b, NULL, pkt);
+	bb->count++;
+	bb->bytes += len;
+	if (bb->bytes >= UBUS_BATCH_BYTES) {
+		ubus_batch_flush(bb);
+	}
+	return 0;
+}
+
+/* returns 1 if the event went into a batch */
+static int ubus_deliver(stEvent_t *e) {
+	stRoute_t *r = route_pub(e->chan);
+	const char *topic = NULL;
+	const char *pkt = (const char *)e->data;
+	if (r != NULL && e->data != NULL) {
+		if (e->type == FRAME_DATA && !r->wild) {
+			topic = r->pattern;
+		} else if (e->type == FRAME_TOPIC && route_match(r, pkt)) {
+			topic = pkt;
+			pkt += strlen(topic) + 1;
+		}
+	}
+	if (topic == NULL) {
+		log_debug("no route for chan %d", e->chan);
+		stats_drop(STATS_DOWN, e->chan);
+		return 0;
+	}
+	stats_out(STATS_DOWN, e);
+	/* urgent events never wait for a batch to fill */
+	if (r->batch && e->prio != EVENT_PRIO_HIGH &&
+			ubus_batch_add(e->chan, topic, pkt) == 0) {
+		return 1;
+	}
+	/* the PKTs already batched on this channel go out first */
+	ubus_batch_flush(&ue.batch[e->chan]);
+	blob_buf_init(&b, 0);
+	blobmsg_add_string(&b, "PKT", pkt);
+	log_debug("ubus send %s:%s", topic, pkt);
+	ubus_send_event(ue.ubus_ctx, topic, b.head);
+	return 0;
+}
+
+static void ubus_run(struct timer *timer) {
+	stEvent_t *e;
+	int budget = UBUS_BATCH_BUDGET;
+	if (!chanq_pop(&ue.eq, &e)) {
+		return;
+	}
+	do {
+		if (e == NULL) {
+			break;
+		}
+		int batched = ubus_deliver(e);
+		event_put(e);
+		/* unbatched routes keep one event per step */
+		if (!batched) {
+			break;
+		}
+	} while (--budget > 0 && chanq_pop(&ue.eq, &e));
+
+	ubus_step();
+}
+static void ubus_in(void *arg, int fd) {
+	ubus_handle_event(ue.ubus_ctx);
+}
+
+enum {
+	UBUS_ATTR_PKT,
+	UBUS_ATTR_PRIO,
+	__UBUS_ATTR_MAX,
+};
+
+static const struct blobmsg_policy ubus_policy[__UBUS_ATTR_MAX] = {
+	[UBUS_ATTR_PKT] = { .name = "PKT", .type = BLOBMSG_TYPE_STRING },
+	[UBUS_ATTR_PRIO] = { .name = "PRIO", .type = BLOBMSG_TYPE_INT32 },
+};
+
+static void receive_ubus_event(struct ubus_context *ctx, struct ubus_event_handler *ev,
+			  const char *type, struct blob_attr *msg) {
+	struct blob_attr *tb[__UBUS_ATTR_MAX];
+
+	if (log_debug_enabled()) {
+		/* formatting to json is for the log only */
+		char *str = blobmsg_format_json(msg, true);
+		log_debug("[ubus msg]: [%s]", str != NULL ? str : "");
+		free(str);
+	}
+
+	blobmsg_parse(ubus_policy, __UBUS_ATTR_MAX, tb, blob_data(msg), blob_len(msg));
+	if (tb[UBUS_ATTR_PKT] == NULL) {
+		log_debug("not find 'PKT' item!");
+		return;
+	}
+	stRoute_t *r = route_of(ev);
+
+	/* the attribute is read in place, event_packet is the only copy */
+	const char *spkt = blobmsg_get_string(tb[UBUS_ATTR_PKT]);
+	if (dedup_check(&ue.dedup, r->chan, type, spkt)) {
+		log_debug("duplicate %s dropped", type);
+		return;
+	}
+	int plen = strlen(spkt) + 1;
+	stEvent_t *e;
+	if (r->wild) {
+		/* the peer needs the concrete topic of a wildcard route */
+		int tlen = strlen(type) + 1;
+		e = event_packet(FRAME_TOPIC, tlen + plen, NULL);
+		if (e == NULL) {
+			return;
+		}
+		memcpy(e->data, type, tlen);
+		memcpy((char *)e->data + tlen, spkt, plen);
+	} else {
+		e = event_packet(FRAME_DATA, plen, (void*)spkt);
+		if (e == NULL) {
+			return;
+		}
+	}
+	e->chan = r->chan;
+	e->prio = r->prio;
+	if (tb[UBUS_ATTR_PRIO] != NULL) {
+		u32 prio = blobmsg_get_u32(tb[UBUS_ATTR_PRIO]);
+		if (prio < EVENT_PRIO_MAX) {
+			e->prio = prio;
+		}
+	}
+	stats_in(STATS_UP, e->chan, e->len);
+	/* the link counts its own drops, only count the limiter's here */
+	unsigned int dropped = r->rl.dropped;
+	if (ratelimit_push(&r->rl, e) < 0 && r->rl.dropped != dropped) {
+		stats_drop(STATS_UP, r->chan);
+	}
+}
+
@@ -0,0 +1,658 @@
+/* in-process stand-in for libubus + ubusd, linked instead of -lubus with
+ * `make UBUS_SHIM=1` so the bridge runs on boxes without ubusd.
+ *
+ * Only the subset the bridge uses is implemented: connect, event handlers,
+ * send_event, objects, lookup and async invoke. Traffic is injected and
+ * observed on a UNIX socket ($UBUS_SHIM_SOCK, default SHIM_SOCK), one text
+ * line per message:
+ *
+ *   event <topic> <json>               both ways, peers see every send_event
+ *   call <seq> <path> <method> <json>  peer -> bridge, invoke a local object
+ *   reply <seq> <status> <json>        bridge -> peer
+ *
+ * The built in object "shim" answers "echo" with its arguments so the
+ * FRAME_REQ path can be driven without any other service.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "common.h"
+#include "log.h"
+
+#include <libubox/blobmsg_json.h>
+#include <libubus.h>
+
+#define SHIM_SOCK				"/tmp/ubus2net-shim.sock"
+#define SHIM_PEER_MAX		8
+#define SHIM_OBJ_MAX		16
+#define SHIM_EV_MAX			64
+#define SHIM_LINE_MAX		(64 * 1024)
+
+enum {
+	SHIM_EVENT,
+	SHIM_CALL,
+};
+
+/* queued work, delivered from ubus_handle_event like ubusd would */
+typedef struct stShimMsg {
+	struct stShimMsg *next;
+	int type;
+	char *name;			/* event topic or method */
+	uint32_t obj;
+	struct ubus_request *req;
+	struct blob_attr *msg;
+}stShimMsg_t;
+
+typedef struct stShimPeer {
+	int fd;
+	int len;
+	char *buf;
+}stShimPeer_t;
+
+typedef struct stShimHandler {
+	struct ubus_event_handler *ev;
+	char *pattern;
+}stShimHandler_t;
+
+typedef struct stShimEnv {
+	struct ubus_context *ctx;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int epfd;
+	int evfd;
+	int lfd;
+
+	stShimHandler_t evs[SHIM_EV_MAX];
+	int nevs;
+	struct ubus_object *objs[SHIM_OBJ_MAX];
+	int nobjs;
+	uint32_t ids;
+	stShimPeer_t peers[SHIM_PEER_MAX];
+
+	stShimMsg_t *head;
+	stShimMsg_t *tail;
+
+	/* request being served, where ubus_send_reply goes */
+	struct ubus_request *cur_req;
+	char *cur_reply;
+
+	struct blob_buf b;
+}stShimEnv_t;
+
+static stShimEnv_t se = {
+	.epfd = -1,
+	.evfd = -1,
+	.lfd = -1,
+};
+
+static int shim_echo(struct ubus_context *ctx, struct ubus_object *obj,
+										 struct ubus_request_data *req, const char *method,
+										 struct blob_attr *msg) {
+	return ubus_send_reply(ctx, req, msg);
+}
+
+static const struct ubus_method shim_methods[] = {
+	UBUS_METHOD_NOARG("echo", shim_echo),
+};
+
+static struct ubus_object_type shim_obj_type = UBUS_OBJECT_TYPE("shim", shim_methods);
+
+static struct ubus_object shim_obj = {
+	.name = "shim",
+	.type = &shim_obj_type,
+	.methods = shim_methods,
+	.n_methods = sizeof(shim_methods)/sizeof(shim_methods[0]),
+};
+
+static void shim_queue(stShimMsg_t *m) {
+	u64 one = 1;
+
+	m->next = NULL;
+	if (se.tail != NULL) {
+		se.tail->next = m;
+	} else {
+		se.head = m;
+	}
+	se.tail = m;
+	/* wake the bridge's poll on ctx->sock.fd */
+	if (write(se.evfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		log_warn("shim wakeup: %s", strerror(errno));
+	}
+}
+
+static void shim_msg_free(stShimMsg_t *m) {
+	/* strdup/blob_memdup, not ours */
+	free(m->name);
+	free(m->msg);
+	FREE(m);
+}
+
+static stShimMsg_t *shim_msg(int type, const char *name, struct blob_attr *msg) {
+	stShimMsg_t *m = MALLOC(sizeof(*m));
+	if (m == NULL) {
+		return NULL;
+	}
+	memset(m, 0, sizeof(*m));
+	m->type = type;
+	m->name = strdup(name);
+	m->msg = blob_memdup(msg);
+	if (m->name == NULL || m->msg == NULL) {
+		shim_msg_free(m);
+		return NULL;
+	}
+	return m;
+}
+
+static struct ubus_object *shim_obj_get(uint32_t id) {
+	int i;
+	for (i = 0; i < se.nobjs; i++) {
+		if (se.objs[i]->id == id) {
+			return se.objs[i];
+		}
+	}
+	return NULL;
+}
+
+/* ubusd rule: a trailing '*' makes the pattern a prefix */
+static int shim_pattern_match(const char *pattern, const char *topic) {
+	int len = strlen(pattern);
+	if (len > 0 && pattern[len - 1] == '*') {
+		return strncmp(pattern, topic, len - 1) == 0;
+	}
+	return strcmp(pattern, topic) == 0;
+}
+
+static void shim_event(const char *topic, struct blob_attr *msg) {
+	int i;
+	for (i = 0; i < se.nevs; i++) {
+		if (shim_pattern_match(se.evs[i].pattern, topic)) {
+			se.evs[i].ev->cb(se.ctx, se.evs[i].ev, topic, msg);
+		}
+	}
+}
+
+static int shim_call(uint32_t id, const char *method, struct blob_attr *msg,
+										 struct ubus_request *req) {
+	struct ubus_request_data rd;
+	struct ubus_object *obj = shim_obj_get(id);
+	int i;
+
+	if (obj == NULL) {
+		return UBUS_STATUS_NOT_FOUND;
+	}
+	for (i = 0; i < obj->n_methods; i++) {
+		if (strcmp(obj->methods[i].name, method) == 0) {
+			break;
+		}
+	}
+	if (i >= obj->n_methods) {
+		return UBUS_STATUS_METHOD_NOT_FOUND;
+	}
+
+	memset(&rd, 0, sizeof(rd));
+	rd.object = id;
+	rd.fd = -1;
+	rd.req_fd = -1;
+	se.cur_req = req;
+	i = obj->methods[i].handler(se.ctx, obj, &rd, method, msg);
+	se.cur_req = NULL;
+	return i;
+}
+
+static void shim_peer_close(stShimPeer_t *p) {
+	epoll_ctl(se.epfd, EPOLL_CTL_DEL, p->fd, NULL);
+	close(p->fd);
+	FREE(p->buf);
+	p->buf = NULL;
+	p->fd = -1;
+	p->len = 0;
+}
+
+/* peers are expected to keep up, a short write drops the peer rather
+ * than leaving half a line on the stream */
+static void shim_peer_write(stShimPeer_t *p, const char *line, int len) {
+	if (send(p->fd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len) {
+		log_warn("shim peer %d too slow, drop", p->fd);
+		shim_peer_close(p);
+	}
+}
+
+static void shim_peer_line(stShimPeer_t *p, char *line) {
+	char *cmd = strsep(&line, " ");
+	char *arg = line != NULL ? strsep(&line, " ") : NULL;
+
+	if (arg == NULL || *arg == 0) {
+		log_warn("shim peer %d bad line", p->fd);
+		return;
+	}
+
+	if (strcmp(cmd, "event") == 0) {
+		blob_buf_init(&se.b, 0);
+		if (line != NULL && *line != 0 && !blobmsg_add_json_from_string(&se.b, line)) {
+			log_warn("shim peer %d bad json for %s", p->fd, arg);
+			return;
+		}
+		shim_event(arg, se.b.head);
+	} else if (strcmp(cmd, "call") == 0) {
+		unsigned int seq = strtoul(arg, NULL, 10);
+		char *path = line != NULL ? strsep(&line, " ") : NULL;
+		char *method = line != NULL ? strsep(&line, " ") : NULL;
+		char *out;
+		uint32_t id;
+		int ret, len;
+
+		blob_buf_init(&se.b, 0);
+		if (method == NULL) {
+			ret = UBUS_STATUS_INVALID_ARGUMENT;
+		} else if (line != NULL && *line != 0 && !blobmsg_add_json_from_string(&se.b, line)) {
+			ret = UBUS_STATUS_INVALID_ARGUMENT;
+		} else if (ubus_lookup_id(se.ctx, path, &id) != 0) {
+			ret = UBUS_STATUS_NOT_FOUND;
+		} else {
+			ret = shim_call(id, method, se.b.head, NULL);
+		}
+
+		len = asprintf(&out, "reply %u %d %s\n", seq, ret,
+									 se.cur_reply != NULL ? se.cur_reply : "{}");
+		if (len > 0) {
+			shim_peer_write(p, out, len);
+			free(out);
+		}
+		free(se.cur_reply);
+		se.cur_reply = NULL;
+	} else {
+		log_warn("shim peer %d unknown command %s", p->fd, cmd);
+	}
+}
+
+static void shim_peer_in(stShimPeer_t *p) {
+	char *s, *nl;
+	int ret;
+
+	ret = read(p->fd, p->buf + p->len, SHIM_LINE_MAX - 1 - p->len);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+	if (ret <= 0) {
+		log_info("shim peer %d gone", p->fd);
+		shim_peer_close(p);
+		return;
+	}
+	p->len += ret;
+	p->buf[p->len] = 0;
+
+	s = p->buf;
+	while (p->fd >= 0 && (nl = strchr(s, '\n')) != NULL) {
+		*nl = 0;
+		if (nl > s && nl[-1] == '\r') {
+			nl[-1] = 0;
+		}
+		if (*s != 0) {
+			shim_peer_line(p, s);
+		}
+		s = nl + 1;
+	}
+	if (p->fd < 0) {
+		return;
+	}
+	p->len -= s - p->buf;
+	memmove(p->buf, s, p->len);
+	if (p->len >= SHIM_LINE_MAX - 1) {
+		log_warn("shim peer %d line too long, drop", p->fd);
+		p->len = 0;
+	}
+}
+
+static void shim_accept(void) {
+	struct epoll_event ev;
+	int i, fd;
+
+	fd = accept4(se.lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	for (i = 0; i < SHIM_PEER_MAX; i++) {
+		if (se.peers[i].fd < 0) {
+			break;
+		}
+	}
+	if (i >= SHIM_PEER_MAX || (se.peers[i].buf = MALLOC(SHIM_LINE_MAX)) == NULL) {
+		log_warn("shim peer table full");
+		close(fd);
+		return;
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	epoll_ctl(se.epfd, EPOLL_CTL_ADD, fd, &ev);
+	se.peers[i].fd = fd;
+	se.peers[i].len = 0;
+	log_info("shim peer %d connected", fd);
+}
+
+static void shim_drain(void) {
+	stShimMsg_t *last = se.tail;
+	stShimMsg_t *m;
+	u64 cnt;
+
+	if (read(se.evfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+		log_warn("shim wakeup read: %s", strerror(errno));
+	}
+	/* one at a time so a handler can still abort what is left, and only up
+	 * to what was queued on entry, the rest raised the eventfd again */
+	while ((m = se.head) != NULL) {
+		int done = m == last;
+		se.head = m->next;
+		if (se.head == NULL) {
+			se.tail = NULL;
+		}
+		if (m->type == SHIM_EVENT) {
+			shim_event(m->name, m->msg);
+		} else {
+			struct ubus_request *req = m->req;
+			int ret = shim_call(m->obj, m->name, m->msg, req);
+			req->status_code = ret;
+			/* may free req */
+			if (req->complete_cb != NULL) {
+				req->complete_cb(req, ret);
+			}
+		}
+		shim_msg_free(m);
+		if (done) {
+			break;
+		}
+	}
+}
+
+static void shim_sock_cb(struct uloop_fd *u, unsigned int events) {
+	struct epoll_event evs[SHIM_PEER_MAX + 2];
+	int i, j, n;
+
+	n = epoll_wait(se.epfd, evs, sizeof(evs)/sizeof(evs[0]), 0);
+	for (i = 0; i < n; i++) {
+		int fd = evs[i].data.fd;
+		if (fd == se.lfd) {
+			shim_accept();
+		} else if (fd == se.evfd) {
+			shim_drain();
+		} else {
+			for (j = 0; j < SHIM_PEER_MAX; j++) {
+				if (se.peers[j].fd == fd) {
+					shim_peer_in(&se.peers[j]);
+					break;
+				}
+			}
+		}
+	}
+}
+
+static int shim_listen(const char *path) {
+	struct sockaddr_un sa;
+	struct epoll_event ev;
+	int fds[2], i;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		return -1;
+	}
+	strcpy(sa.sun_path, path);
+	strcpy(se.path, path);
+
+	se.epfd = epoll_create1(EPOLL_CLOEXEC);
+	se.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	se.lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (se.epfd < 0 || se.evfd < 0 || se.lfd < 0) {
+		return -2;
+	}
+	unlink(path);
+	if (bind(se.lfd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(se.lfd, SHIM_PEER_MAX) != 0) {
+		return -3;
+	}
+
+	fds[0] = se.lfd;
+	fds[1] = se.evfd;
+	for (i = 0; i < 2; i++) {
+		ev.events = EPOLLIN;
+		ev.data.fd = fds[i];
+		if (epoll_ctl(se.epfd, EPOLL_CTL_ADD, fds[i], &ev) != 0) {
+			return -4;
+		}
+	}
+	for (i = 0; i < SHIM_PEER_MAX; i++) {
+		se.peers[i].fd = -1;
+	}
+	return 0;
+}
+
+struct ubus_context *ubus_connect(const char *path) {
+	struct ubus_context *ctx;
+	int ret;
+
+	if (se.ctx != NULL) {
+		log_err("shim supports a single context");
+		return NULL;
+	}
+	if (path == NULL) {
+		path = getenv("UBUS_SHIM_SOCK");
+	}
+	if (path == NULL) {
+		path = SHIM_SOCK;
+	}
+
+	ctx = MALLOC(sizeof(*ctx));
+	if (ctx == NULL) {
+		return NULL;
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	INIT_LIST_HEAD(&ctx->requests);
+	INIT_LIST_HEAD(&ctx->pending);
+	se.ctx = ctx;
+
+	ret = shim_listen(path);
+	if (ret != 0) {
+		log_err("shim listen %s: %d, %s", path, ret, strerror(errno));
+		ubus_free(ctx);
+		return NULL;
+	}
+	ctx->sock.fd = se.epfd;
+	ctx->sock.cb = shim_sock_cb;
+	ubus_add_object(ctx, &shim_obj);
+	log_info("ubus shim on %s", path);
+	return ctx;
+}
+
+void ubus_free(struct ubus_context *ctx) {
+	stShimMsg_t *m;
+	int i;
+
+	while ((m = se.head) != NULL) {
+		se.head = m->next;
+		shim_msg_free(m);
+	}
+	se.tail = NULL;
+	for (i = 0; i < SHIM_PEER_MAX; i++) {
+		if (se.peers[i].fd >= 0) {
+			shim_peer_close(&se.peers[i]);
+		}
+	}
+	for (i = 0; i < se.nevs; i++) {
+		free(se.evs[i].pattern);
+	}
+	se.nevs = 0;
+	se.nobjs = 0;
+	if (se.lfd >= 0) {
+		close(se.lfd);
+		unlink(se.path);
+	}
+	if (se.evfd >= 0) {
+		close(se.evfd);
+	}
+	if (se.epfd >= 0) {
+		close(se.epfd);
+	}
+	se.lfd = se.evfd = se.epfd = -1;
+	blob_buf_free(&se.b);
+	se.ctx = NULL;
+	FREE(ctx);
+}
+
+int ubus_register_event_handler(struct ubus_context *ctx,
+																struct ubus_event_handler *ev, const char *pattern) {
+	if (se.nevs >= SHIM_EV_MAX) {
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+	se.evs[se.nevs].pattern = strdup(pattern);
+	if (se.evs[se.nevs].pattern == NULL) {
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+	se.evs[se.nevs].ev = ev;
+	se.nevs++;
+	return 0;
+}
+
+int ubus_unregister_event_handler(struct ubus_context *ctx, struct ubus_event_handler *ev) {
+	int i = 0;
+	while (i < se.nevs) {
+		if (se.evs[i].ev == ev) {
+			free(se.evs[i].pattern);
+			se.evs[i] = se.evs[--se.nevs];
+		} else {
+			i++;
+		}
+	}
+	return 0;
+}
+
+int ubus_send_event(struct ubus_context *ctx, const char *id, struct blob_attr *data) {
+	stShimMsg_t *m;
+	char *json, *line;
+	int i, len;
+
+	json = blobmsg_format_json(data, true);
+	len = asprintf(&line, "event %s %s\n", id, json != NULL ? json : "{}");
+	for (i = 0; i < SHIM_PEER_MAX && len > 0; i++) {
+		if (se.peers[i].fd >= 0) {
+			shim_peer_write(&se.peers[i], line, len);
+		}
+	}
+	if (len > 0) {
+		free(line);
+	}
+	free(json);
+
+	/* ubusd also hands the event back to local subscribers */
+	m = shim_msg(SHIM_EVENT, id, data);
+	if (m == NULL) {
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+	shim_queue(m);
+	return 0;
+}
+
+int ubus_add_object(struct ubus_context *ctx, struct ubus_object *obj) {
+	if (se.nobjs >= SHIM_OBJ_MAX) {
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+	obj->id = ++se.ids;
+	se.objs[se.nobjs++] = obj;
+	return 0;
+}
+
+int ubus_lookup_id(struct ubus_context *ctx, const char *path, uint32_t *id) {
+	int i;
+	for (i = 0; i < se.nobjs; i++) {
+		if (strcmp(se.objs[i]->name, path) == 0) {
+			*id = se.objs[i]->id;
+			return 0;
+		}
+	}
+	return UBUS_STATUS_NOT_FOUND;
+}
+
+int ubus_invoke_async_fd(struct ubus_context *ctx, uint32_t obj, const char *method,
+												 struct blob_attr *msg, struct ubus_request *req, int fd) {
+	stShimMsg_t *m;
+
+	memset(req, 0, sizeof(*req));
+	INIT_LIST_HEAD(&req->list);
+	INIT_LIST_HEAD(&req->pending);
+	req->ctx = ctx;
+	req->peer = obj;
+	req->seq = ++ctx->request_seq;
+	req->fd = -1;
+
+	m = shim_msg(SHIM_CALL, method, msg);
+	if (m == NULL) {
+		return UBUS_STATUS_UNKNOWN_ERROR;
+	}
+	m->obj = obj;
+	m->req = req;
+	shim_queue(m);
+	return 0;
+}
+
+/* the request is already queued, completion runs from ubus_handle_event */
+void ubus_complete_request_async(struct ubus_context *ctx, struct ubus_request *req) {
+}
+
+void ubus_abort_request(struct ubus_context *ctx, struct ubus_request *req) {
+	stShimMsg_t **pm = &se.head;
+	stShimMsg_t *prev = NULL;
+
+	req->cancelled = true;
+	while (*pm != NULL) {
+		stShimMsg_t *m = *pm;
+		if (m->type == SHIM_CALL && m->req == req) {
+			*pm = m->next;
+			if (se.tail == m) {
+				se.tail = prev;
+			}
+			shim_msg_free(m);
+			return;
+		}
+		prev = m;
+		pm = &m->next;
+	}
+}
+
+int ubus_send_reply(struct ubus_context *ctx, struct ubus_request_data *rd,
+										struct blob_attr *msg) {
+	if (se.cur_req != NULL) {
+		if (se.cur_req->data_cb != NULL) {
+			se.cur_req->data_cb(se.cur_req, UBUS_MSG_DATA, msg);
+		}
+		return 0;
+	}
+	/* a socket peer's call, shim_peer_line writes it out */
+	free(se.cur_reply);
+	se.cur_reply = blobmsg_format_json(msg, true);
+	return 0;
+}
+
+const char *ubus_strerror(int error) {
+	static const char *const str[] = {
+		[UBUS_STATUS_OK] = "Success",
+		[UBUS_STATUS_INVALID_COMMAND] = "Invalid command",
+		[UBUS_STATUS_INVALID_ARGUMENT] = "Invalid argument",
+		[UBUS_STATUS_METHOD_NOT_FOUND] = "Method not found",
+		[UBUS_STATUS_NOT_FOUND] = "Not found",
+		[UBUS_STATUS_NO_DATA] = "No response",
+		[UBUS_STATUS_PERMISSION_DENIED] = "Permission denied",
+		[UBUS_STATUS_TIMEOUT] = "Request timed out",
+		[UBUS_STATUS_NOT_SUPPORTED] = "Operation not supported",
+		[UBUS_STATUS_UNKNOWN_ERROR] = "Unknown error",
+		[UBUS_STATUS_CONNECTION_FAILED] = "Connection failed",
+	};
+
+	if (error < 0 || error >= sizeof(str)/sizeof(str[0]) || str[error] == NULL) {
+		return "Unknown error";
+	}
+	return str[error];
+}
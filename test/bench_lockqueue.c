@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "log.h"
+#include "lockqueue.h"
+
+/* N producers push M elements each into one stLockQueue_t, one consumer
+ * pops them in batches and now and then takes the newest with pop_back.
+ * Built once per queue (see the Makefile), every element must arrive
+ * exactly once and each producer's elements in order.
+ * usage: bench_lockqueue_{ring,list} [producers [elements]] */
+
+#ifdef LOCKQUEUE_RING
+#define LQ_NAME		"ring"
+#else
+#define LQ_NAME		"list"
+#endif
+
+#define BENCH_PRODUCERS		4
+#define BENCH_ELEMS				200000
+#define BENCH_BATCH				64
+#define BENCH_BACK_EVERY	16		/* consumer rounds between pop_backs */
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); \
+		exit(1); \
+	} \
+} while (0)
+
+static stLockQueue_t lq;
+static int elems = BENCH_ELEMS;
+
+/* producer in the high bits, 1 based sequence in the low, never NULL */
+#define ELEM(p, i)		((void *)(((uintptr_t)(p) << 24) | ((i) + 1)))
+#define ELEM_P(e)			((int)((uintptr_t)(e) >> 24))
+#define ELEM_I(e)			((int)((uintptr_t)(e) & 0xffffff) - 1)
+
+static void *producer(void *arg) {
+	int p = (int)(intptr_t)arg;
+	int i;
+
+	for (i = 0; i < elems; i++) {
+		lockqueue_push(&lq, ELEM(p, i));
+	}
+	return NULL;
+}
+
+static long now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* e arrived: once, and after everything its producer pushed before it */
+static void take(void *e, int *last, u8 *seen, int nprod, int in_order) {
+	int p = ELEM_P(e);
+	int i = ELEM_I(e);
+
+	CHECK(p >= 0 && p < nprod && i >= 0 && i < elems);
+	CHECK(!seen[p * elems + i]);
+	seen[p * elems + i] = 1;
+	if (in_order) {
+		CHECK(i > last[p]);
+		last[p] = i;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int nprod = argc > 1 ? atoi(argv[1]) : BENCH_PRODUCERS;
+	pthread_t th[64];
+	void *ev[BENCH_BATCH];
+	int *last;
+	u8 *seen;
+	long total, got = 0, backs = 0, start, us;
+	int i, n, round = 0;
+
+	if (argc > 2) {
+		elems = atoi(argv[2]);
+	}
+	CHECK(nprod > 0 && nprod <= 64 && elems > 0 && elems < 0xffffff);
+	log_init(argv[0], LOG_OPT_CONSOLE_OUT);
+	total = (long)nprod * elems;
+	last = MALLOC(nprod * sizeof(*last));
+	seen = MALLOC(total);
+	CHECK(last != NULL && seen != NULL);
+	memset(seen, 0, total);
+	for (i = 0; i < nprod; i++) {
+		last[i] = -1;
+	}
+
+	lockqueue_init(&lq);
+	start = now_us();
+	for (i = 0; i < nprod; i++) {
+		CHECK(pthread_create(&th[i], NULL, producer, (void *)(intptr_t)i) == 0);
+	}
+	while (got < total) {
+		/* only we pop, so a queue seen non-empty stays non-empty */
+		if (++round % BENCH_BACK_EVERY == 0 && !lockqueue_empty(&lq)) {
+			CHECK(lockqueue_pop_back(&lq, &ev[0]));
+			take(ev[0], last, seen, nprod, 0);
+			got++;
+			backs++;
+		}
+		n = lockqueue_pop_batch(&lq, ev, BENCH_BATCH);
+		for (i = 0; i < n; i++) {
+			take(ev[i], last, seen, nprod, 1);
+		}
+		got += n;
+		if (n == 0) {
+			sched_yield();
+		}
+	}
+	us = now_us() - start;
+	for (i = 0; i < nprod; i++) {
+		pthread_join(th[i], NULL);
+	}
+	CHECK(lockqueue_empty(&lq));
+	lockqueue_destroy(&lq, NULL);
+	FREE(last);
+	FREE(seen);
+
+	printf("%s: %d producers x %d, %ld pop_back: %ld us, %.2f Mops/s\n",
+				 LQ_NAME, nprod, elems, backs, us, us > 0 ? (double)total / us : 0.0);
+	printf("ok %s\n", argv[0]);
+	return 0;
+}
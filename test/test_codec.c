@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "log.h"
+#include "buffer.h"
+#include "tcp.h"
+#include "codec.h"
+
+/* what the open codec batch holds counts as backlog, and one read
+ * can not inflate into more than CODEC_DECODE_MAX */
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); \
+		exit(1); \
+	} \
+} while (0)
+
+#define BOMB_LEN		(4 * CODEC_DECODE_MAX)
+
+/* deflate len zeros, the whole batch as one buffer */
+static char *deflate_zeros(unsigned int len, unsigned int *olen) {
+	stCodec_t *c = codec_new("deflate", 1, NULL, 0);
+	char *zeros = MALLOC(len);
+	char *out;
+
+	CHECK(c != NULL && zeros != NULL);
+	memset(zeros, 0, len);
+	CHECK(codec_encode(c, zeros, len) == 0);
+	CHECK(codec_flush(c, &out, olen) == 0 && out != NULL);
+	FREE(zeros);
+	codec_free(c);
+	return out;
+}
+
+/* what codec_recv gives back once the peer wrote buf */
+static int recv_all(const char *buf, unsigned int len, struct queue_buf *qb) {
+	stCodec_t *rx = codec_new("deflate", 0, NULL, 0);
+	int sv[2], ret;
+
+	CHECK(rx != NULL);
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	CHECK(write(sv[0], buf, len) == len);
+	tcp_nonblock(sv[1]);
+	/* 0 once drained, the writer stays open */
+	do {
+		ret = codec_recv(rx, NULL, sv[1], qb, 4096);
+	} while (ret > 0);
+	close(sv[0]);
+	close(sv[1]);
+	codec_free(rx);
+	return ret;
+}
+
+int main(int argc, char *argv[]) {
+	struct queue_buf qb;
+	stTcpOut_t out;
+	char frame[1024];
+	char *buf;
+	unsigned int len;
+	int sv[2], i;
+
+	log_init(argv[0], LOG_OPT_CONSOLE_OUT);
+
+	/* nothing reaches the queue before a flush, the backlog sees it anyway */
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	tcp_out_init(&out, sv[0]);
+	out.codec = codec_new("deflate", 1, NULL, 0);
+	CHECK(out.codec != NULL);
+	memset(frame, 'x', sizeof(frame));
+	for (i = 0; i < 64; i++) {
+		CHECK(tcp_out_send(&out, frame, sizeof(frame), NULL, NULL) > 0);
+	}
+	CHECK(out.bytes == 0);
+	CHECK(tcp_out_backlog(&out) == 64 * sizeof(frame));
+	CHECK(tcp_out_flush(&out) == 0);
+	CHECK(tcp_out_backlog(&out) == 0);
+	tcp_out_free(&out);
+	close(sv[0]);
+	close(sv[1]);
+
+	/* a few KB that inflate to 4M: refused, the caller closes */
+	buf = deflate_zeros(BOMB_LEN, &len);
+	CHECK(len < CODEC_DECODE_MAX / 64);
+	queue_buf_init(&qb, 0, 4096);
+	CHECK(recv_all(buf, len, &qb) < 0);
+	CHECK(queue_buf_len(&qb) <= CODEC_DECODE_MAX);
+	queue_buf_reset(&qb);
+	FREE(buf);
+
+	/* the same ratio under the bound still goes through */
+	buf = deflate_zeros(CODEC_DECODE_MAX / 2, &len);
+	CHECK(recv_all(buf, len, &qb) == 0);
+	CHECK(queue_buf_len(&qb) == CODEC_DECODE_MAX / 2);
+	queue_buf_reset(&qb);
+	FREE(buf);
+
+	printf("ok %s\n", argv[0]);
+	return 0;
+}
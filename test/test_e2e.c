@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* svr and cli built with make UBUS_SHIM=1 and their default routes, one
+ * event each way over the link on localhost:
+ *   cli DS.GREENPOWER -> svr
+ *   svr DS.GATEWAY    -> cli
+ * usage: test_e2e ubus2net_svr ubus2net_cli */
+
+#define E2E_WAIT_MS			10000
+#define E2E_RESEND_MS		500		/* the link may still be connecting */
+#define E2E_LINE_MAX		4096
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); \
+		cleanup(); \
+		exit(1); \
+	} \
+} while (0)
+
+typedef struct stPeer {
+	char path[108];
+	pid_t pid;
+	int fd;
+	char buf[E2E_LINE_MAX];
+	int len;
+}stPeer_t;
+
+static char dir[] = "/tmp/test_e2e_XXXXXX";
+static stPeer_t svr = { .pid = -1, .fd = -1 };
+static stPeer_t cli = { .pid = -1, .fd = -1 };
+
+static void peer_stop(stPeer_t *p) {
+	if (p->fd >= 0) {
+		close(p->fd);
+		p->fd = -1;
+	}
+	if (p->pid > 0) {
+		kill(p->pid, SIGTERM);
+		waitpid(p->pid, NULL, 0);
+		p->pid = -1;
+	}
+	if (p->path[0] != 0) {
+		unlink(p->path);
+	}
+}
+
+static void cleanup(void) {
+	peer_stop(&cli);
+	peer_stop(&svr);
+	rmdir(dir);
+}
+
+static long now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void peer_start(stPeer_t *p, const char *name, char *const argv[]) {
+	snprintf(p->path, sizeof(p->path), "%s/%s.sock", dir, name);
+	p->pid = fork();
+	CHECK(p->pid >= 0);
+	if (p->pid == 0) {
+		setenv("UBUS_SHIM_SOCK", p->path, 1);
+		execv(argv[0], argv);
+		printf("exec %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+}
+
+/* the shim socket shows up once the bridge ran ubus_connect */
+static void peer_attach(stPeer_t *p) {
+	struct sockaddr_un sa;
+	long end = now_ms() + E2E_WAIT_MS;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, p->path);
+	do {
+		p->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		CHECK(p->fd >= 0);
+		if (connect(p->fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+			return;
+		}
+		close(p->fd);
+		p->fd = -1;
+		CHECK(waitpid(p->pid, NULL, WNOHANG) == 0);
+		usleep(50 * 1000);
+	} while (now_ms() < end);
+	CHECK(!"shim socket never came up");
+}
+
+static void peer_send(stPeer_t *p, const char *topic, const char *pkt) {
+	char line[E2E_LINE_MAX];
+	int len;
+
+	len = snprintf(line, sizeof(line), "event %s {\"PKT\":\"%s\"}\n", topic, pkt);
+	CHECK(write(p->fd, line, len) == len);
+}
+
+/* returns 1 once a line for topic carrying pkt was read, 0 after ms */
+static int peer_wait(stPeer_t *p, const char *topic, const char *pkt, int ms) {
+	struct pollfd pfd = { .fd = p->fd, .events = POLLIN };
+	long end = now_ms() + ms;
+	char *s, *nl;
+	int ret;
+
+	while (now_ms() < end) {
+		ret = poll(&pfd, 1, end - now_ms());
+		if (ret <= 0) {
+			continue;
+		}
+		ret = read(p->fd, p->buf + p->len, sizeof(p->buf) - 1 - p->len);
+		CHECK(ret > 0);
+		p->len += ret;
+		p->buf[p->len] = 0;
+
+		s = p->buf;
+		while ((nl = strchr(s, '\n')) != NULL) {
+			*nl = 0;
+			if (strncmp(s, "event ", 6) == 0 &&
+			    strncmp(s + 6, topic, strlen(topic)) == 0 &&
+			    strstr(s, pkt) != NULL) {
+				return 1;
+			}
+			s = nl + 1;
+		}
+		p->len -= s - p->buf;
+		memmove(p->buf, s, p->len);
+		CHECK(p->len < (int)sizeof(p->buf) - 1);
+	}
+	return 0;
+}
+
+/* inject on from until to publishes it */
+static void pass(stPeer_t *from, stPeer_t *to, const char *topic, const char *pkt) {
+	long end = now_ms() + E2E_WAIT_MS;
+
+	do {
+		peer_send(from, topic, pkt);
+		if (peer_wait(to, topic, pkt, E2E_RESEND_MS)) {
+			printf("%s %s passed\n", topic, pkt);
+			return;
+		}
+	} while (now_ms() < end);
+	printf("FAIL %s %s never arrived\n", topic, pkt);
+	cleanup();
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 3) {
+		printf("usage: %s ubus2net_svr ubus2net_cli\n", argv[0]);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	CHECK(mkdtemp(dir) != NULL);
+
+	char *svr_argv[] = { argv[1], NULL };
+	char *cli_argv[] = { argv[2], "-a", "127.0.0.1", NULL };
+	peer_start(&svr, "svr", svr_argv);
+	peer_attach(&svr);
+	peer_start(&cli, "cli", cli_argv);
+	peer_attach(&cli);
+
+	pass(&cli, &svr, "DS.GREENPOWER", "up-0123");
+	pass(&svr, &cli, "DS.GATEWAY", "down-4567");
+
+	cleanup();
+	printf("ok %s\n", argv[0]);
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "frame.h"
+#include "route.h"
+#include "pipe.h"
+
+/* a "filter" stage with "topics" on both pipes: up takes the topic of a
+ * DATA frame from the SUB route of its channel, down from the PUB route */
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); \
+		exit(1); \
+	} \
+} while (0)
+
+struct timer_head th = {
+	.first = NULL,
+};
+
+static int up_got;
+static int down_got;
+
+static int up_sink(stEvent_t *e) {
+	up_got++;
+	event_put(e);
+	return 0;
+}
+
+static int down_sink(stEvent_t *e) {
+	down_got++;
+	event_put(e);
+	return 0;
+}
+
+static void add_filter(stPipe_t *p, const char *spec) {
+	json_t *conf = json_loads(spec, 0, NULL);
+
+	CHECK(conf != NULL);
+	CHECK(pipe_add(p, "filter", conf) == 0);
+	json_decref(conf);
+}
+
+static void push(stPipe_t *p, int chan) {
+	char pkt[] = "{\"cmd\":\"report\"}";
+	stEvent_t *e = event_packet(FRAME_DATA, sizeof(pkt), pkt);
+
+	CHECK(e != NULL);
+	e->chan = chan;
+	CHECK(pipe_push(p, e) == 0);
+}
+
+int main(int argc, char *argv[]) {
+	stPipe_t up, down;
+
+	log_init(argv[0], LOG_OPT_CONSOLE_OUT);
+	CHECK(route_init() == 0);
+	/* one channel, a different topic each way */
+	CHECK(route_add("DS.GREENPOWER", 2, ROUTE_SUB) == 0);
+	CHECK(route_add("DS.GATEWAY", 2, ROUTE_PUB) == 0);
+	/* published only */
+	CHECK(route_add("DS.ZB.STATE", 3, ROUTE_PUB) == 0);
+
+	pipe_init(&up, "up", ROUTE_SUB, &th, up_sink);
+	pipe_init(&down, "down", ROUTE_PUB, &th, down_sink);
+	add_filter(&up, "{\"topics\":[\"DS.GREENPOWER\"]}");
+	add_filter(&down, "{\"topics\":[\"DS.GATEWAY\", \"DS.ZB.\"]}");
+
+	push(&up, 2);
+	CHECK(up_got == 1);
+	push(&down, 2);
+	CHECK(down_got == 1);
+	push(&down, 3);
+	CHECK(down_got == 2);
+	CHECK(down.head->dropped == 0);
+
+	/* the SUB topic of the channel is not what comes down */
+	pipe_free(&down);
+	pipe_init(&down, "down", ROUTE_PUB, &th, down_sink);
+	add_filter(&down, "{\"topics\":[\"DS.GREENPOWER\"]}");
+	push(&down, 2);
+	CHECK(down_got == 2 && down.head->dropped == 1);
+
+	pipe_free(&up);
+	pipe_free(&down);
+	route_free();
+	printf("ok %s\n", argv[0]);
+	return 0;
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "log.h"
+#include "seal.h"
+
+/* records of one connection replayed into another or reflected back
+ * to their sender must not open, see seal.h */
+
+#define CHECK(x) do { \
+	if (!(x)) { \
+		printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #x); \
+		exit(1); \
+	} \
+} while (0)
+
+typedef struct stWire {
+	char buf[4096];
+	unsigned int len;
+}stWire_t;
+
+typedef struct stLink {
+	stSeal_t *tx;
+	stSeal_t *rx;
+	stWire_t out;	/* everything tx put on the wire */
+	char got[256];
+	unsigned int glen;
+}stLink_t;
+
+static int sink(void *arg, const void *buf, unsigned int len) {
+	stLink_t *l = arg;
+
+	CHECK(l->glen + len <= sizeof(l->got));
+	memcpy(l->got + l->glen, buf, len);
+	l->glen += len;
+	return 0;
+}
+
+/* flush tx, returns what this flush wrote, also kept in l->out */
+static unsigned int flush(stLink_t *l, stWire_t *w) {
+	char *buf;
+	unsigned int len;
+
+	CHECK(seal_flush(l->tx, &buf, &len) == 0);
+	if (buf == NULL) {
+		w->len = 0;
+		return 0;
+	}
+	CHECK(l->out.len + len <= sizeof(l->out.buf));
+	memcpy(l->out.buf + l->out.len, buf, len);
+	l->out.len += len;
+	memcpy(w->buf, buf, len);
+	w->len = len;
+	FREE(buf);
+	return len;
+}
+
+static void link_open(stLink_t *l, int dir) {
+	memset(l, 0, sizeof(*l));
+	CHECK(seal_pair(&l->tx, &l->rx, dir) == 0);
+}
+
+static void link_close(stLink_t *l) {
+	seal_free(l->tx);
+	seal_free(l->rx);
+}
+
+/* cli and svr swap salts, then cli sends msg */
+static void handshake(stLink_t *cli, stLink_t *svr, const char *msg, stWire_t *rec) {
+	stWire_t w;
+
+	CHECK(seal_put(cli->tx, msg, strlen(msg)) == 0);
+	/* nothing can be sealed before the peer's salt, only ours goes */
+	CHECK(flush(cli, &w) == SEAL_SALT_LEN);
+	CHECK(seal_open(svr->rx, w.buf, w.len, sink, svr) == 0);
+	CHECK(flush(svr, &w) == SEAL_SALT_LEN);
+	CHECK(seal_open(cli->rx, w.buf, w.len, sink, cli) == 0);
+	CHECK(cli->tx->keyed && svr->tx->keyed);
+
+	CHECK(flush(cli, rec) > 0);
+	CHECK(seal_open(svr->rx, rec->buf, rec->len, sink, svr) == 0);
+	CHECK(svr->glen == strlen(msg) && memcmp(svr->got, msg, svr->glen) == 0);
+}
+
+int main(int argc, char *argv[]) {
+	char path[] = "/tmp/test_seal_XXXXXX";
+	stLink_t cli, svr, cli2, svr2;
+	stWire_t rec, w;
+	int fd;
+
+	log_init(argv[0], LOG_OPT_CONSOLE_OUT);
+	fd = mkstemp(path);
+	CHECK(fd >= 0);
+	CHECK(write(fd, "000102030405060708090a0b0c0d0e0f", 32) == 32);
+	close(fd);
+	CHECK(seal_key_load(path) == 0);
+	unlink(path);
+
+	link_open(&cli, SEAL_C2S);
+	link_open(&svr, SEAL_S2C);
+	handshake(&cli, &svr, "first connection", &rec);
+
+	/* the same record twice in one connection */
+	CHECK(seal_open(svr.rx, rec.buf, rec.len, sink, &svr) < 0);
+
+	/* reflected to its sender */
+	CHECK(seal_open(cli.rx, rec.buf, rec.len, sink, &cli) < 0);
+
+	/* the whole client stream, salt included, replayed into a new
+	 * connection: the server picked a new salt, nothing opens */
+	link_open(&svr2, SEAL_S2C);
+	CHECK(flush(&svr2, &w) == SEAL_SALT_LEN);
+	CHECK(seal_open(svr2.rx, cli.out.buf, cli.out.len, sink, &svr2) < 0);
+	CHECK(svr2.glen == 0);
+	link_close(&svr2);
+
+	/* a fresh connection with the same key still works */
+	link_open(&cli2, SEAL_C2S);
+	link_open(&svr2, SEAL_S2C);
+	handshake(&cli2, &svr2, "second connection", &w);
+
+	link_close(&cli);
+	link_close(&svr);
+	link_close(&cli2);
+	link_close(&svr2);
+	printf("ok %s\n", argv[0]);
+	return 0;
+}